@@ -3,12 +3,14 @@ out vec4 FragColor;
 
 in vec2 TexCoord;
 
-// texture samplers
-uniform sampler2D texture1;
-uniform sampler2D texture2;
+// both textures are layers of one texture array
+uniform sampler2DArray textures;
+// per material: xy scales the texcoords into a padded image, z is the layer
+uniform vec3 layer1;
+uniform vec3 layer2;
 
 void main()
 {
 	// linearly interpolate between both textures (80% container, 20% awesomeface)
-	FragColor = mix(texture(texture1, TexCoord), texture(texture2, TexCoord), 0.2);
+	FragColor = mix(texture(textures, vec3(TexCoord * layer1.xy, layer1.z)), texture(textures, vec3(TexCoord * layer2.xy, layer2.z)), 0.2);
 }
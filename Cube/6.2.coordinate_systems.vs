@@ -4,12 +4,22 @@ layout (location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// the same for every draw of a frame; see FrameUniforms in cube.cpp
+layout (std140) uniform Frame
+{
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	float time;
+};
+// one per draw, from the same ring buffer; see DrawUniforms
+layout (std140) uniform Draw
+{
+	mat4 model;
+};
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0f);
+	gl_Position = viewProjection * model * vec4(aPos, 1.0f);
 	TexCoord = vec2(aTexCoord.x, aTexCoord.y);
 }
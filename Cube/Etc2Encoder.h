@@ -0,0 +1,720 @@
+#ifndef ETC2_ENCODER_H
+#define ETC2_ENCODER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ETC2_ENCODER_SSE2
+#endif
+
+// compresses 8-bit RGB images to GL_COMPRESSED_RGB8_ETC2 and RGBA images to
+// GL_COMPRESSED_RGBA8_ETC2_EAC, both core formats in GLES 3.0. color blocks use
+// the ETC1-compatible individual and differential modes plus ETC2's planar mode,
+// which handles smooth gradients; alpha uses EAC. blocks are spread over worker
+// threads, and candidate encodings are scored four pixels at a time with SSE2.
+class Etc2Encoder
+{
+public:
+    enum Quality
+    {
+        Fast,   // one base color per subblock, taken from its average
+        High    // also searches the neighbouring base colors and alpha parameters
+    };
+
+    // totals over everything the encoder has compressed so far
+    struct Stats
+    {
+        double squaredError = 0.0;
+        double samples = 0.0;
+        double pixels = 0.0;
+        double seconds = 0.0;
+
+        double psnr() const
+        {
+            if (squaredError <= 0.0)
+                return std::numeric_limits<double>::infinity();
+            return 10.0 * std::log10(255.0 * 255.0 * samples / squaredError);
+        }
+        double megapixelsPerSecond() const
+        {
+            return seconds > 0.0 ? pixels / seconds / 1e6 : 0.0;
+        }
+    };
+
+    // threads = 0 uses one per hardware thread
+    explicit Etc2Encoder(Quality quality = Fast, int threads = 0)
+        : quality(quality), threads(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+    {
+    }
+
+    static GLenum format(int channels)
+    {
+        return channels == 4 ? GL_COMPRESSED_RGBA8_ETC2_EAC : GL_COMPRESSED_RGB8_ETC2;
+    }
+    static size_t compressedSize(int width, int height, int channels)
+    {
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(channels);
+    }
+
+    // compress tightly packed 3 or 4 channel pixels. blocks hanging over the
+    // right or bottom edge repeat the last column or row.
+    // ------------------------------------------------------------------------
+    std::vector<unsigned char> encode(const unsigned char *pixels, int width, int height, int channels)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        std::vector<unsigned char> out(compressedSize(width, height, channels));
+
+        // workers take block rows off a shared counter and keep their own error sums
+        std::atomic<int> nextRow(0);
+        int workerCount = std::min(threads, blocksY);
+        std::vector<double> errors(workerCount, 0.0);
+        auto work = [&](int worker)
+        {
+            for (int by; (by = nextRow++) < blocksY; )
+                for (int bx = 0; bx < blocksX; ++bx)
+                {
+                    unsigned char *block = &out[((size_t)by * blocksX + bx) * blockBytes(channels)];
+                    errors[worker] += encodeBlock(block, pixels, width, height, channels, bx * 4, by * 4);
+                }
+        };
+        std::vector<std::thread> workers;
+        for (int i = 1; i < workerCount; ++i)
+            workers.emplace_back(work, i);
+        work(0);
+        for (auto &worker : workers)
+            worker.join();
+
+        for (double error : errors)
+            totals.squaredError += error;
+        totals.samples += (double)width * height * channels;
+        totals.pixels += (double)width * height;
+        totals.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return out;
+    }
+
+    const Stats &stats() const
+    {
+        return totals;
+    }
+
+    // decode one block to 16 RGBA texels, in row-major order, the way the GPU
+    // would. the encoder uses it to measure its error.
+    // ------------------------------------------------------------------------
+    static void decodeBlock(const unsigned char *block, int channels, unsigned char rgba[16 * 4])
+    {
+        uint64_t color = readBits(block + (channels == 4 ? 8 : 0));
+        decodeColor(color, rgba);
+        if (channels == 4)
+            decodeAlpha(readBits(block), rgba);
+        else
+            for (int i = 0; i < 16; ++i)
+                rgba[i * 4 + 3] = 255;
+    }
+
+private:
+    Quality quality;
+    int threads;
+    Stats totals;
+
+    static const int colorModifiers[8][4];
+    static const int alphaModifiers[16][8];
+
+    // a block's texels as floats, one array per channel, in the column-major
+    // order ETC indexes them (texel x, y is at x * 4 + y)
+    struct Texels
+    {
+        float r[16], g[16], b[16];
+        int a[16];
+    };
+    // the eight texels of one subblock
+    struct Subblock
+    {
+        float r[8], g[8], b[8];
+    };
+    struct Color
+    {
+        int r, g, b;
+    };
+
+    static int blockBytes(int channels)
+    {
+        return channels == 4 ? 16 : 8;
+    }
+    static int clamp255(int value)
+    {
+        return value < 0 ? 0 : value > 255 ? 255 : value;
+    }
+    static uint64_t readBits(const unsigned char *block)
+    {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i)
+            bits = (bits << 8) | block[i];
+        return bits;
+    }
+    static void writeBits(unsigned char *block, uint64_t bits)
+    {
+        for (int i = 7; i >= 0; --i, bits >>= 8)
+            block[i] = (unsigned char)(bits & 0xff);
+    }
+    static int expand4(int value) { return (value << 4) | value; }
+    static int expand5(int value) { return (value << 3) | (value >> 2); }
+    static int expand6(int value) { return (value << 2) | (value >> 4); }
+    static int expand7(int value) { return (value << 1) | (value >> 6); }
+
+    // subblock texels: flip 0 splits the block into left and right halves,
+    // flip 1 into top and bottom
+    static int subblockTexel(int flip, int sub, int i)
+    {
+        if (!flip)
+            return sub * 8 + i;
+        return (i / 2) * 4 + sub * 2 + (i & 1);
+    }
+
+    // squared error of a subblock against a base color and modifier table,
+    // with every texel taking its best modifier
+    static float subblockError(const Subblock &s, const Color &base, int table)
+    {
+        float cr[4], cg[4], cb[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            int m = colorModifiers[table][i];
+            cr[i] = (float)clamp255(base.r + m);
+            cg[i] = (float)clamp255(base.g + m);
+            cb[i] = (float)clamp255(base.b + m);
+        }
+#ifdef ETC2_ENCODER_SSE2
+        __m128 total = _mm_setzero_ps();
+        for (int half = 0; half < 8; half += 4)
+        {
+            __m128 r = _mm_loadu_ps(s.r + half), g = _mm_loadu_ps(s.g + half), b = _mm_loadu_ps(s.b + half);
+            __m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128 dr = _mm_sub_ps(r, _mm_set1_ps(cr[i]));
+                __m128 dg = _mm_sub_ps(g, _mm_set1_ps(cg[i]));
+                __m128 db = _mm_sub_ps(b, _mm_set1_ps(cb[i]));
+                __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+                best = _mm_min_ps(best, e);
+            }
+            total = _mm_add_ps(total, best);
+        }
+        // every term is an integer well below 2^24, so the order of the sum doesn't matter
+        float lanes[4];
+        _mm_storeu_ps(lanes, total);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+        float total = 0.0f;
+        for (int p = 0; p < 8; ++p)
+        {
+            float best = std::numeric_limits<float>::max();
+            for (int i = 0; i < 4; ++i)
+            {
+                float dr = s.r[p] - cr[i], dg = s.g[p] - cg[i], db = s.b[p] - cb[i];
+                best = std::min(best, dr * dr + dg * dg + db * db);
+            }
+            total += best;
+        }
+        return total;
+#endif
+    }
+    // while no channel clamps, a texel's error against base + m is
+    // |texel - base|^2 - 2 m d + 3 m^2, with d the texel's summed difference from
+    // the base. the modifiers come in +-small, +-large pairs, so only |d| matters
+    // and each table costs two candidates per texel instead of four colors.
+    static float unclampedError(const float distance[8], const float offset[8], int table)
+    {
+        float small = (float)colorModifiers[table][0], large = (float)colorModifiers[table][1];
+#ifdef ETC2_ENCODER_SSE2
+        __m128 total = _mm_setzero_ps();
+        __m128 two = _mm_set1_ps(2.0f);
+        __m128 smallBias = _mm_set1_ps(3.0f * small * small), largeBias = _mm_set1_ps(3.0f * large * large);
+        __m128 smallScale = _mm_set1_ps(small), largeScale = _mm_set1_ps(large);
+        for (int half = 0; half < 8; half += 4)
+        {
+            __m128 d = _mm_mul_ps(two, _mm_loadu_ps(offset + half));
+            __m128 e = _mm_min_ps(_mm_sub_ps(smallBias, _mm_mul_ps(smallScale, d)), _mm_sub_ps(largeBias, _mm_mul_ps(largeScale, d)));
+            total = _mm_add_ps(total, _mm_add_ps(_mm_loadu_ps(distance + half), e));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, total);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+        float total = 0.0f;
+        for (int p = 0; p < 8; ++p)
+        {
+            float d = 2.0f * offset[p];
+            total += distance[p] + std::min(3.0f * small * small - small * d, 3.0f * large * large - large * d);
+        }
+        return total;
+#endif
+    }
+    static float bestTable(const Subblock &s, const Color &base, int &table)
+    {
+        float distance[8], offset[8];
+        for (int p = 0; p < 8; ++p)
+        {
+            float dr = s.r[p] - base.r, dg = s.g[p] - base.g, db = s.b[p] - base.b;
+            distance[p] = dr * dr + dg * dg + db * db;
+            offset[p] = std::fabs(dr + dg + db);
+        }
+        int lo = std::min(base.r, std::min(base.g, base.b)), hi = std::max(base.r, std::max(base.g, base.b));
+
+        float best = std::numeric_limits<float>::max();
+        for (int t = 0; t < 8; ++t)
+        {
+            int large = colorModifiers[t][1];
+            float error = lo - large >= 0 && hi + large <= 255
+                ? unclampedError(distance, offset, t)
+                : subblockError(s, base, t);
+            if (error < best)
+            {
+                best = error;
+                table = t;
+            }
+        }
+        return best;
+    }
+
+    // one way to code a subblock: a quantized base color (4 or 5 bits per
+    // channel), its table and the resulting error
+    struct Choice
+    {
+        Color code;
+        int table;
+        float error;
+    };
+    // at most 3 x 3 x 3 in High quality
+    static const int maxChoices = 27;
+    int subblockChoices(const Subblock &s, int bits, Choice choices[maxChoices]) const
+    {
+        float average[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 8; ++i)
+        {
+            average[0] += s.r[i];
+            average[1] += s.g[i];
+            average[2] += s.b[i];
+        }
+        int levels = (1 << bits) - 1;
+        int center[3];
+        for (int c = 0; c < 3; ++c)
+            center[c] = (int)std::floor(average[c] / 8.0f * levels / 255.0f + 0.5f);
+
+        int reach = quality == High ? 1 : 0;
+        int count = 0;
+        for (int dr = -reach; dr <= reach; ++dr)
+            for (int dg = -reach; dg <= reach; ++dg)
+                for (int db = -reach; db <= reach; ++db)
+                {
+                    Choice choice;
+                    choice.code.r = center[0] + dr;
+                    choice.code.g = center[1] + dg;
+                    choice.code.b = center[2] + db;
+                    if (choice.code.r < 0 || choice.code.r > levels || choice.code.g < 0 || choice.code.g > levels ||
+                        choice.code.b < 0 || choice.code.b > levels)
+                        continue;
+                    Color base = bits == 4
+                        ? Color{ expand4(choice.code.r), expand4(choice.code.g), expand4(choice.code.b) }
+                        : Color{ expand5(choice.code.r), expand5(choice.code.g), expand5(choice.code.b) };
+                    choice.table = 0;
+                    choice.error = bestTable(s, base, choice.table);
+                    choices[count++] = choice;
+                }
+        return count;
+    }
+
+    static void gatherTexels(Texels &t, const unsigned char *pixels, int width, int height, int channels, int x0, int y0)
+    {
+        for (int x = 0; x < 4; ++x)
+            for (int y = 0; y < 4; ++y)
+            {
+                int sx = std::min(x0 + x, width - 1), sy = std::min(y0 + y, height - 1);
+                const unsigned char *p = pixels + ((size_t)sy * width + sx) * channels;
+                int i = x * 4 + y;
+                t.r[i] = p[0];
+                t.g[i] = p[1];
+                t.b[i] = p[2];
+                t.a[i] = channels == 4 ? p[3] : 255;
+            }
+    }
+
+    // returns the squared error over the texels inside the image
+    double encodeBlock(unsigned char *block, const unsigned char *pixels, int width, int height, int channels, int x0, int y0) const
+    {
+        Texels texels;
+        gatherTexels(texels, pixels, width, height, channels, x0, y0);
+        if (channels == 4)
+        {
+            writeBits(block, encodeAlpha(texels));
+            block += 8;
+        }
+        writeBits(block, encodeColor(texels));
+
+        unsigned char decoded[16 * 4];
+        decodeBlock(channels == 4 ? block - 8 : block, channels, decoded);
+        double error = 0.0;
+        for (int y = 0; y < 4 && y0 + y < height; ++y)
+            for (int x = 0; x < 4 && x0 + x < width; ++x)
+            {
+                const unsigned char *p = pixels + ((size_t)(y0 + y) * width + x0 + x) * channels;
+                for (int c = 0; c < channels; ++c)
+                {
+                    double d = (double)p[c] - decoded[(y * 4 + x) * 4 + c];
+                    error += d * d;
+                }
+            }
+        return error;
+    }
+
+    uint64_t encodeColor(const Texels &texels) const
+    {
+        float bestError = std::numeric_limits<float>::max();
+        uint64_t best = 0;
+        for (int flip = 0; flip < 2; ++flip)
+        {
+            Subblock subs[2];
+            for (int sub = 0; sub < 2; ++sub)
+                for (int i = 0; i < 8; ++i)
+                {
+                    int p = subblockTexel(flip, sub, i);
+                    subs[sub].r[i] = texels.r[p];
+                    subs[sub].g[i] = texels.g[p];
+                    subs[sub].b[i] = texels.b[p];
+                }
+
+            // individual mode: each subblock picks its own 4-bit base color
+            Choice individual[2];
+            for (int sub = 0; sub < 2; ++sub)
+            {
+                Choice choices[maxChoices];
+                int count = subblockChoices(subs[sub], 4, choices);
+                individual[sub] = *std::min_element(choices, choices + count,
+                    [](const Choice &a, const Choice &b) { return a.error < b.error; });
+            }
+            if (individual[0].error + individual[1].error < bestError)
+            {
+                bestError = individual[0].error + individual[1].error;
+                best = packColor(texels, flip, false, individual);
+            }
+
+            // differential mode: 5-bit base colors no more than -4..3 apart
+            Choice first[maxChoices], second[maxChoices];
+            int firstCount = subblockChoices(subs[0], 5, first), secondCount = subblockChoices(subs[1], 5, second);
+            for (int i = 0; i < firstCount; ++i)
+                for (int j = 0; j < secondCount; ++j)
+                {
+                    const Choice &a = first[i], &b = second[j];
+                    int dr = b.code.r - a.code.r, dg = b.code.g - a.code.g, db = b.code.b - a.code.b;
+                    if (dr < -4 || dr > 3 || dg < -4 || dg > 3 || db < -4 || db > 3)
+                        continue;
+                    if (a.error + b.error < bestError)
+                    {
+                        bestError = a.error + b.error;
+                        Choice pair[2] = { a, b };
+                        best = packColor(texels, flip, true, pair);
+                    }
+                }
+        }
+
+        uint64_t planar;
+        if (encodePlanar(texels, planar, bestError))
+            best = planar;
+        return best;
+    }
+
+    static uint64_t packColor(const Texels &texels, int flip, bool differential, const Choice choices[2])
+    {
+        uint64_t bits = 0;
+        const Color &c0 = choices[0].code, &c1 = choices[1].code;
+        if (differential)
+        {
+            bits |= (uint64_t)c0.r << 59 | (uint64_t)((c1.r - c0.r) & 7) << 56;
+            bits |= (uint64_t)c0.g << 51 | (uint64_t)((c1.g - c0.g) & 7) << 48;
+            bits |= (uint64_t)c0.b << 43 | (uint64_t)((c1.b - c0.b) & 7) << 40;
+        }
+        else
+        {
+            bits |= (uint64_t)c0.r << 60 | (uint64_t)c1.r << 56;
+            bits |= (uint64_t)c0.g << 52 | (uint64_t)c1.g << 48;
+            bits |= (uint64_t)c0.b << 44 | (uint64_t)c1.b << 40;
+        }
+        bits |= (uint64_t)choices[0].table << 37 | (uint64_t)choices[1].table << 34;
+        bits |= (uint64_t)(differential ? 1 : 0) << 33 | (uint64_t)flip << 32;
+
+        for (int sub = 0; sub < 2; ++sub)
+        {
+            const Color &code = choices[sub].code;
+            Color base = differential
+                ? Color{ expand5(code.r), expand5(code.g), expand5(code.b) }
+                : Color{ expand4(code.r), expand4(code.g), expand4(code.b) };
+            for (int i = 0; i < 8; ++i)
+            {
+                int p = subblockTexel(flip, sub, i);
+                int index = 0;
+                float best = std::numeric_limits<float>::max();
+                for (int m = 0; m < 4; ++m)
+                {
+                    int modifier = colorModifiers[choices[sub].table][m];
+                    float dr = texels.r[p] - clamp255(base.r + modifier);
+                    float dg = texels.g[p] - clamp255(base.g + modifier);
+                    float db = texels.b[p] - clamp255(base.b + modifier);
+                    float e = dr * dr + dg * dg + db * db;
+                    if (e < best)
+                    {
+                        best = e;
+                        index = m;
+                    }
+                }
+                bits |= (uint64_t)(index >> 1) << (16 + p) | (uint64_t)(index & 1) << p;
+            }
+        }
+        return bits;
+    }
+
+    // planar mode stores three colors O, H and V (6:7:6 bits) and interpolates
+    // the block between them. a least squares fit of the plane gives the colors;
+    // the block is only replaced if the plane beats error.
+    bool encodePlanar(const Texels &texels, uint64_t &bits, float error) const
+    {
+        // fit c(x, y) = o + x * (h - o) / 4 + y * (v - o) / 4 per channel
+        const float *channel[3] = { texels.r, texels.g, texels.b };
+        int o[3], h[3], v[3];
+        static const int bitsPerChannel[3] = { 6, 7, 6 };
+        for (int c = 0; c < 3; ++c)
+        {
+            float sum = 0.0f, sumX = 0.0f, sumY = 0.0f;
+            for (int x = 0; x < 4; ++x)
+                for (int y = 0; y < 4; ++y)
+                {
+                    float value = channel[c][x * 4 + y];
+                    sum += value;
+                    sumX += value * (x - 1.5f);
+                    sumY += value * (y - 1.5f);
+                }
+            // x - 1.5 and y - 1.5 are centred, so the fit separates
+            float mean = sum / 16.0f, slopeX = sumX / 20.0f, slopeY = sumY / 20.0f;
+            float oc = mean - 1.5f * slopeX - 1.5f * slopeY;
+            int levels = (1 << bitsPerChannel[c]) - 1;
+            o[c] = std::max(0, std::min(levels, (int)std::floor(oc * levels / 255.0f + 0.5f)));
+            h[c] = std::max(0, std::min(levels, (int)std::floor((oc + 4.0f * slopeX) * levels / 255.0f + 0.5f)));
+            v[c] = std::max(0, std::min(levels, (int)std::floor((oc + 4.0f * slopeY) * levels / 255.0f + 0.5f)));
+        }
+
+        bits = packPlanar(o, h, v);
+        unsigned char decoded[16 * 4];
+        decodeColor(bits, decoded);
+        float planarError = 0.0f;
+        for (int x = 0; x < 4; ++x)
+            for (int y = 0; y < 4; ++y)
+            {
+                const unsigned char *d = decoded + (y * 4 + x) * 4;
+                float dr = texels.r[x * 4 + y] - d[0], dg = texels.g[x * 4 + y] - d[1], db = texels.b[x * 4 + y] - d[2];
+                planarError += dr * dr + dg * dg + db * db;
+            }
+        return planarError < error;
+    }
+
+    // planar mode hides in differential mode: read as differential, red and
+    // green stay in range and blue overflows. bits 63, 55, 47..45 and 42 are
+    // free and get set to make that happen.
+    static uint64_t packPlanar(const int o[3], const int h[3], const int v[3])
+    {
+        uint64_t bits = 0;
+        bits |= (uint64_t)o[0] << 57;
+        bits |= (uint64_t)(o[1] >> 6) << 56 | (uint64_t)(o[1] & 63) << 49;
+        bits |= (uint64_t)(o[2] >> 5) << 48 | (uint64_t)((o[2] >> 3) & 3) << 43 | (uint64_t)(o[2] & 7) << 39;
+        bits |= (uint64_t)(h[0] >> 1) << 34 | (uint64_t)(h[0] & 1) << 32;
+        bits |= (uint64_t)h[1] << 25 | (uint64_t)h[2] << 19;
+        bits |= (uint64_t)v[0] << 13 | (uint64_t)v[1] << 6 | (uint64_t)v[2];
+        bits |= (uint64_t)1 << 33;
+
+        // red and green: a negative delta gets a base of at least 16, a
+        // positive one a base below 16, so neither can leave 0..31
+        bits |= ((bits >> 58) & 1) << 63;
+        bits |= ((bits >> 50) & 1) << 55;
+        // blue: the two stored bits of the base and of the delta decide
+        // whether pushing it over 31 or under 0 is possible
+        int stored = (int)((bits >> 43) & 3) + (int)((bits >> 40) & 3);
+        if (stored >= 4)
+            bits |= (uint64_t)7 << 45;
+        else
+            bits |= (uint64_t)1 << 42;
+        return bits;
+    }
+    static int signExtend3(int value)
+    {
+        return value >= 4 ? value - 8 : value;
+    }
+
+    static void decodeColor(uint64_t bits, unsigned char rgba[16 * 4])
+    {
+        bool differential = (bits >> 33) & 1;
+        int flip = (int)(bits >> 32) & 1;
+        Color base[2];
+        if (differential)
+        {
+            int r = (int)(bits >> 59) & 31, dr = signExtend3((int)(bits >> 56) & 7);
+            int g = (int)(bits >> 51) & 31, dg = signExtend3((int)(bits >> 48) & 7);
+            int b = (int)(bits >> 43) & 31, db = signExtend3((int)(bits >> 40) & 7);
+            if (b + db < 0 || b + db > 31)
+            {
+                if (r + dr >= 0 && r + dr <= 31 && g + dg >= 0 && g + dg <= 31)
+                {
+                    decodePlanar(bits, rgba);
+                    return;
+                }
+            }
+            base[0] = Color{ expand5(r), expand5(g), expand5(b) };
+            base[1] = Color{ expand5(r + dr), expand5(g + dg), expand5(b + db) };
+        }
+        else
+        {
+            base[0] = Color{ expand4((int)(bits >> 60) & 15), expand4((int)(bits >> 52) & 15), expand4((int)(bits >> 44) & 15) };
+            base[1] = Color{ expand4((int)(bits >> 56) & 15), expand4((int)(bits >> 48) & 15), expand4((int)(bits >> 40) & 15) };
+        }
+        int tables[2] = { (int)(bits >> 37) & 7, (int)(bits >> 34) & 7 };
+        for (int x = 0; x < 4; ++x)
+            for (int y = 0; y < 4; ++y)
+            {
+                int p = x * 4 + y;
+                int sub = flip ? (y >= 2) : (x >= 2);
+                int index = (int)((bits >> (16 + p)) & 1) << 1 | (int)((bits >> p) & 1);
+                int modifier = colorModifiers[tables[sub]][index];
+                unsigned char *out = rgba + (y * 4 + x) * 4;
+                out[0] = (unsigned char)clamp255(base[sub].r + modifier);
+                out[1] = (unsigned char)clamp255(base[sub].g + modifier);
+                out[2] = (unsigned char)clamp255(base[sub].b + modifier);
+            }
+    }
+    static void decodePlanar(uint64_t bits, unsigned char rgba[16 * 4])
+    {
+        int o[3], h[3], v[3];
+        o[0] = expand6((int)(bits >> 57) & 63);
+        o[1] = expand7((int)((bits >> 56) & 1) << 6 | (int)((bits >> 49) & 63));
+        o[2] = expand6((int)((bits >> 48) & 1) << 5 | (int)((bits >> 43) & 3) << 3 | (int)((bits >> 39) & 7));
+        h[0] = expand6((int)((bits >> 34) & 31) << 1 | (int)((bits >> 32) & 1));
+        h[1] = expand7((int)(bits >> 25) & 127);
+        h[2] = expand6((int)(bits >> 19) & 63);
+        v[0] = expand6((int)(bits >> 13) & 63);
+        v[1] = expand7((int)(bits >> 6) & 127);
+        v[2] = expand6((int)bits & 63);
+        for (int y = 0; y < 4; ++y)
+            for (int x = 0; x < 4; ++x)
+                for (int c = 0; c < 3; ++c)
+                    rgba[(y * 4 + x) * 4 + c] = (unsigned char)clamp255((x * (h[c] - o[c]) + y * (v[c] - o[c]) + 4 * o[c] + 2) >> 2);
+    }
+
+    uint64_t encodeAlpha(const Texels &texels) const
+    {
+        int lo = 255, hi = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            lo = std::min(lo, texels.a[i]);
+            hi = std::max(hi, texels.a[i]);
+        }
+        // a flat block is exact with the one table that has a zero modifier
+        if (lo == hi)
+            return packAlpha(texels, lo, 1, 13);
+
+        int bestError = std::numeric_limits<int>::max();
+        uint64_t best = 0;
+        int reach = quality == High ? 1 : 0;
+        for (int table = 0; table < 16; ++table)
+        {
+            const int *modifiers = alphaModifiers[table];
+            int span = modifiers[7] - modifiers[3];
+            int estimate = std::max(1, std::min(15, (hi - lo + span / 2) / span));
+            for (int multiplier = estimate - reach; multiplier <= estimate + reach; ++multiplier)
+            {
+                if (multiplier < 1 || multiplier > 15)
+                    continue;
+                // centre the table's range on the block's range
+                int center = (int)std::floor((lo + hi) / 2.0f - (modifiers[7] + modifiers[3]) * multiplier / 2.0f + 0.5f);
+                for (int base = center - 2 * reach; base <= center + 2 * reach; ++base)
+                {
+                    int b = clamp255(base);
+                    int error = alphaError(texels, b, multiplier, table);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        best = packAlpha(texels, b, multiplier, table);
+                    }
+                }
+            }
+        }
+        return best;
+    }
+    static int alphaError(const Texels &texels, int base, int multiplier, int table)
+    {
+        int values[8];
+        for (int i = 0; i < 8; ++i)
+            values[i] = clamp255(base + alphaModifiers[table][i] * multiplier);
+        int total = 0;
+        for (int p = 0; p < 16; ++p)
+        {
+            int best = std::numeric_limits<int>::max();
+            for (int i = 0; i < 8; ++i)
+            {
+                int d = texels.a[p] - values[i];
+                best = std::min(best, d * d);
+            }
+            total += best;
+        }
+        return total;
+    }
+    static uint64_t packAlpha(const Texels &texels, int base, int multiplier, int table)
+    {
+        uint64_t bits = (uint64_t)base << 56 | (uint64_t)multiplier << 52 | (uint64_t)table << 48;
+        for (int p = 0; p < 16; ++p)
+        {
+            int index = 0, best = std::numeric_limits<int>::max();
+            for (int i = 0; i < 8; ++i)
+            {
+                int d = texels.a[p] - clamp255(base + alphaModifiers[table][i] * multiplier);
+                if (d * d < best)
+                {
+                    best = d * d;
+                    index = i;
+                }
+            }
+            bits |= (uint64_t)index << (45 - 3 * p);
+        }
+        return bits;
+    }
+    static void decodeAlpha(uint64_t bits, unsigned char rgba[16 * 4])
+    {
+        int base = (int)(bits >> 56) & 255, multiplier = (int)(bits >> 52) & 15, table = (int)(bits >> 48) & 15;
+        for (int x = 0; x < 4; ++x)
+            for (int y = 0; y < 4; ++y)
+            {
+                int index = (int)(bits >> (45 - 3 * (x * 4 + y))) & 7;
+                rgba[(y * 4 + x) * 4 + 3] = (unsigned char)clamp255(base + alphaModifiers[table][index] * multiplier);
+            }
+    }
+};
+
+// modifiers in index order: small positive, large positive, small negative, large negative
+const int Etc2Encoder::colorModifiers[8][4] = {
+    {  2,   8,  -2,   -8 }, {  5,  17,  -5,  -17 }, {  9,  29,  -9,  -29 }, { 13,  42, -13,  -42 },
+    { 18,  60, -18,  -60 }, { 24,  80, -24,  -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 }
+};
+
+const int Etc2Encoder::alphaModifiers[16][8] = {
+    { -3, -6,  -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 },
+    { -2, -5,  -8, -13, 1, 4, 7, 12 }, { -2, -4,  -6, -13, 1, 3, 5, 12 },
+    { -3, -6,  -8, -12, 2, 5, 7, 11 }, { -3, -7,  -9, -11, 2, 6, 8, 10 },
+    { -4, -7,  -8, -11, 3, 6, 7, 10 }, { -3, -5,  -8, -11, 2, 4, 7, 10 },
+    { -2, -6,  -8, -10, 1, 5, 7,  9 }, { -2, -5,  -8, -10, 1, 4, 7,  9 },
+    { -2, -4,  -8, -10, 1, 3, 7,  9 }, { -2, -5,  -7, -10, 1, 4, 6,  9 },
+    { -3, -4,  -7, -10, 2, 3, 6,  9 }, { -1, -2,  -3, -10, 0, 1, 2,  9 },
+    { -4, -6,  -8,  -9, 3, 5, 7,  8 }, { -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+#endif
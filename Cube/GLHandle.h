@@ -0,0 +1,300 @@
+#ifndef GL_HANDLE_H
+#define GL_HANDLE_H
+
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// the kinds of GL object GLDeletionQueue deletes and GLHandle owns
+enum class GLObject
+{
+    Program,
+    Buffer,
+    VertexArray,
+    Texture,
+    Sampler,
+    Framebuffer,
+    Renderbuffer,
+    ProgramPipeline,
+    Count
+};
+
+// GL objects waiting to be deleted. deleting an object the GPU may still be
+// reading makes some drivers wait for it, so objects retired during a frame
+// are collected into a batch that frame() fences once the frame is drawn,
+// and the batch is deleted, a glDelete call per kind, in a later frame()
+// once the fence has passed.
+//
+// retire() can be called from any thread; frame() and flush() make GL calls,
+// so they belong to the thread that owns the context.
+class GLDeletionQueue
+{
+public:
+    struct Stats
+    {
+        int retired = 0;
+        int deleted = 0;
+        int batches = 0;
+    };
+
+    static GLDeletionQueue &shared()
+    {
+        static GLDeletionQueue queue;
+        return queue;
+    }
+
+    // delete name once the frames that may use it are done with it
+    // ------------------------------------------------------------------------
+    void retire(GLObject kind, GLuint name)
+    {
+        if (!name)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        open.names[(int)kind].push_back(name);
+        ++counters.retired;
+    }
+    void retire(GLsync sync)
+    {
+        if (!sync)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        open.syncs.push_back(sync);
+        ++counters.retired;
+    }
+    // at the end of a frame, after its last draw: fence what the frame
+    // retired and delete the batches the GPU is done with
+    // ------------------------------------------------------------------------
+    void frame()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!open.empty())
+        {
+            open.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            closed.push_back(std::move(open));
+            open = Batch();
+        }
+        // batches are fenced in order, so the first one still running ends it
+        while (!closed.empty())
+        {
+            GLenum status = glClientWaitSync(closed.front().fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+                break;
+            // a wait that fails would fail again every frame and hold the
+            // queue up for good, so wait for the GPU as flush() does
+            if (status == GL_WAIT_FAILED)
+            {
+                std::cout << "ERROR::GL_DELETION_QUEUE::WAIT_FAILED" << std::endl;
+                glFinish();
+            }
+            destroy(closed.front());
+            closed.pop_front();
+        }
+    }
+    // delete everything retired so far, waiting for the GPU if it has to,
+    // e.g. before the context goes away
+    // ------------------------------------------------------------------------
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        glFinish();
+        for (Batch &batch : closed)
+            destroy(batch);
+        closed.clear();
+        destroy(open);
+        open = Batch();
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+private:
+    struct Batch
+    {
+        std::vector<GLuint> names[(int)GLObject::Count];
+        std::vector<GLsync> syncs;
+        GLsync fence = 0;
+
+        bool empty() const
+        {
+            for (const std::vector<GLuint> &kind : names)
+                if (!kind.empty())
+                    return false;
+            return syncs.empty();
+        }
+    };
+
+    std::mutex mutex;
+    Batch open;
+    std::deque<Batch> closed;
+    Stats counters;
+
+    void destroy(Batch &batch)
+    {
+        for (GLuint program : batch.names[(int)GLObject::Program])
+            glDeleteProgram(program);
+        const std::vector<GLuint> &buffers = batch.names[(int)GLObject::Buffer];
+        const std::vector<GLuint> &vertexArrays = batch.names[(int)GLObject::VertexArray];
+        const std::vector<GLuint> &textures = batch.names[(int)GLObject::Texture];
+        const std::vector<GLuint> &samplers = batch.names[(int)GLObject::Sampler];
+        const std::vector<GLuint> &framebuffers = batch.names[(int)GLObject::Framebuffer];
+        const std::vector<GLuint> &renderbuffers = batch.names[(int)GLObject::Renderbuffer];
+        const std::vector<GLuint> &pipelines = batch.names[(int)GLObject::ProgramPipeline];
+        if (!buffers.empty())
+            glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+        if (!vertexArrays.empty())
+            glDeleteVertexArrays((GLsizei)vertexArrays.size(), vertexArrays.data());
+        if (!textures.empty())
+            glDeleteTextures((GLsizei)textures.size(), textures.data());
+        if (!samplers.empty())
+            glDeleteSamplers((GLsizei)samplers.size(), samplers.data());
+        if (!framebuffers.empty())
+            glDeleteFramebuffers((GLsizei)framebuffers.size(), framebuffers.data());
+        if (!renderbuffers.empty())
+            glDeleteRenderbuffers((GLsizei)renderbuffers.size(), renderbuffers.data());
+        if (!pipelines.empty())
+            glDeleteProgramPipelines((GLsizei)pipelines.size(), pipelines.data());
+        for (GLsync sync : batch.syncs)
+            glDeleteSync(sync);
+        if (batch.fence)
+            glDeleteSync(batch.fence);
+        for (const std::vector<GLuint> &kind : batch.names)
+            counters.deleted += (int)kind.size();
+        counters.deleted += (int)batch.syncs.size();
+        ++counters.batches;
+    }
+};
+
+// the name of one GL object, which it owns: moving the handle moves the
+// object, and destroying it retires the object to GLDeletionQueue. it
+// converts to the name, so it goes straight into GL calls.
+template <GLObject Kind>
+class GLHandle
+{
+public:
+    GLHandle() {}
+    // take ownership of an existing name
+    explicit GLHandle(GLuint name) : name(name) {}
+    ~GLHandle()
+    {
+        reset();
+    }
+    GLHandle(GLHandle &&other) noexcept : name(other.release()) {}
+    GLHandle &operator=(GLHandle &&other) noexcept
+    {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+    GLHandle(const GLHandle&) = delete;
+    GLHandle& operator=(const GLHandle&) = delete;
+
+    // a new object of the handle's kind
+    // ------------------------------------------------------------------------
+    static GLHandle create()
+    {
+        GLuint created = 0;
+        switch (Kind)
+        {
+        case GLObject::Program: created = glCreateProgram(); break;
+        case GLObject::Buffer: glGenBuffers(1, &created); break;
+        case GLObject::VertexArray: glGenVertexArrays(1, &created); break;
+        case GLObject::Texture: glGenTextures(1, &created); break;
+        case GLObject::Sampler: glGenSamplers(1, &created); break;
+        case GLObject::Framebuffer: glGenFramebuffers(1, &created); break;
+        case GLObject::Renderbuffer: glGenRenderbuffers(1, &created); break;
+        case GLObject::ProgramPipeline: glGenProgramPipelines(1, &created); break;
+        default: break;
+        }
+        return GLHandle(created);
+    }
+
+    operator GLuint() const
+    {
+        return name;
+    }
+    GLuint get() const
+    {
+        return name;
+    }
+    // give up ownership, returning the name
+    GLuint release()
+    {
+        GLuint released = name;
+        name = 0;
+        return released;
+    }
+    // retire the object, if there is one, and own replacement instead
+    void reset(GLuint replacement = 0)
+    {
+        GLDeletionQueue::shared().retire(Kind, name);
+        name = replacement;
+    }
+
+private:
+    GLuint name = 0;
+};
+
+typedef GLHandle<GLObject::Program> GLProgram;
+typedef GLHandle<GLObject::Buffer> GLBuffer;
+typedef GLHandle<GLObject::VertexArray> GLVertexArray;
+typedef GLHandle<GLObject::Texture> GLTexture;
+typedef GLHandle<GLObject::Sampler> GLSampler;
+typedef GLHandle<GLObject::Framebuffer> GLFramebuffer;
+typedef GLHandle<GLObject::Renderbuffer> GLRenderbuffer;
+typedef GLHandle<GLObject::ProgramPipeline> GLProgramPipeline;
+
+// a fence sync, owned the same way
+class GLSync
+{
+public:
+    GLSync() {}
+    explicit GLSync(GLsync sync) : sync(sync) {}
+    ~GLSync()
+    {
+        reset();
+    }
+    GLSync(GLSync &&other) noexcept : sync(other.release()) {}
+    GLSync &operator=(GLSync &&other) noexcept
+    {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+    GLSync(const GLSync&) = delete;
+    GLSync& operator=(const GLSync&) = delete;
+
+    // a fence after the commands issued so far
+    static GLSync fence()
+    {
+        return GLSync(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    }
+
+    operator GLsync() const
+    {
+        return sync;
+    }
+    GLsync get() const
+    {
+        return sync;
+    }
+    GLsync release()
+    {
+        GLsync released = sync;
+        sync = 0;
+        return released;
+    }
+    void reset(GLsync replacement = 0)
+    {
+        GLDeletionQueue::shared().retire(sync);
+        sync = replacement;
+    }
+
+private:
+    GLsync sync = 0;
+};
+#endif
@@ -0,0 +1,227 @@
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_CHAIN_SSE2
+#endif
+
+// a full mip chain built on the CPU, with every level tightly packed in one
+// buffer so the whole chain goes up in a single pass, without glGenerateMipmap.
+// building it doesn't touch GL, so it can run on whichever thread decoded the image.
+class MipChain
+{
+public:
+    struct Level
+    {
+        int width;
+        int height;
+        size_t offset;
+    };
+
+    int channels = 0;
+    bool srgb = false;
+    std::vector<Level> levels;
+    std::vector<unsigned char> data;
+
+    MipChain() {}
+    // build the chain for 8-bit pixels with 1 to 4 channels, tightly packed.
+    // if srgb is set the color channels are sRGB encoded and get filtered in
+    // linear space. alpha (the last channel of 2 and 4 channel images) is always
+    // linear, and weights the color channels so transparent texels don't bleed
+    // their color into their neighbours. maxLevels stops the chain early, e.g.
+    // 2 to halve an image once; 0 builds it down to 1x1.
+    // ------------------------------------------------------------------------
+    MipChain(const unsigned char *pixels, int width, int height, int channels, bool srgb, int maxLevels = 0)
+        : channels(channels), srgb(srgb)
+    {
+        size_t total = 0;
+        for (int w = width, h = height; ; w = half(w), h = half(h))
+        {
+            levels.push_back({ w, h, total });
+            total += (size_t)w * h * channels;
+            if ((w == 1 && h == 1) || (int)levels.size() == maxLevels)
+                break;
+        }
+        data.resize(total);
+        std::copy(pixels, pixels + (size_t)width * height * channels, data.begin());
+
+        bool hasAlpha = channels == 2 || channels == 4;
+        int colorChannels = hasAlpha ? channels - 1 : channels;
+        std::vector<float> current = toLinear(pixels, width, height, colorChannels, hasAlpha);
+        std::vector<float> next, row;
+        for (size_t level = 1; level < levels.size(); ++level)
+        {
+            const Level &src = levels[level - 1];
+            const Level &dst = levels[level];
+            next.resize((size_t)dst.width * dst.height * channels);
+            row.resize((size_t)src.width * channels);
+            for (int y = 0; y < dst.height; ++y)
+            {
+                int rows[3];
+                float rowWeights[3];
+                footprint(src.height, y, rows, rowWeights);
+                const float *sources[3];
+                for (int i = 0; i < 3; ++i)
+                    sources[i] = &current[(size_t)rows[i] * src.width * channels];
+                blendRows(&row[0], sources, rowWeights, src.width * channels);
+                filterRow(&next[(size_t)y * dst.width * channels], &row[0], src.width, dst.width);
+            }
+            fromLinear(&data[dst.offset], next, colorChannels, hasAlpha);
+            current.swap(next);
+        }
+    }
+
+    const unsigned char *pixels(int level) const
+    {
+        return data.data() + levels[level].offset;
+    }
+
+private:
+    static int half(int size)
+    {
+        return size > 1 ? size / 2 : 1;
+    }
+    // source texels and weights behind output texel i of a dimension of size n.
+    // odd sizes use the three tap polyphase box, which keeps every source texel's
+    // total weight equal instead of dropping the last row or column. unused taps
+    // get weight 0 and point at a valid texel.
+    static void footprint(int n, int i, int index[3], float weight[3])
+    {
+        if (n == 1)
+        {
+            index[0] = index[1] = index[2] = 0;
+            weight[0] = 1.0f; weight[1] = weight[2] = 0.0f;
+        }
+        else if (n % 2 == 0)
+        {
+            index[0] = 2 * i; index[1] = index[2] = 2 * i + 1;
+            weight[0] = weight[1] = 0.5f; weight[2] = 0.0f;
+        }
+        else
+        {
+            int m = n / 2;
+            index[0] = 2 * i; index[1] = 2 * i + 1; index[2] = 2 * i + 2;
+            weight[0] = float(m - i) / n;
+            weight[1] = float(m) / n;
+            weight[2] = float(i + 1) / n;
+        }
+    }
+    static void blendRows(float *out, const float *const rows[3], const float weight[3], int count)
+    {
+        int i = 0;
+#ifdef MIP_CHAIN_SSE2
+        __m128 w0 = _mm_set1_ps(weight[0]), w1 = _mm_set1_ps(weight[1]), w2 = _mm_set1_ps(weight[2]);
+        for (; i + 3 < count; i += 4)
+        {
+            __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(rows[0] + i), w0), _mm_mul_ps(_mm_loadu_ps(rows[1] + i), w1));
+            _mm_storeu_ps(out + i, _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[2] + i), w2)));
+        }
+#endif
+        for (; i < count; ++i)
+            out[i] = (rows[0][i] * weight[0] + rows[1][i] * weight[1]) + rows[2][i] * weight[2];
+    }
+    void filterRow(float *out, const float *row, int srcWidth, int dstWidth) const
+    {
+        for (int x = 0; x < dstWidth; ++x)
+        {
+            int columns[3];
+            float weight[3];
+            footprint(srcWidth, x, columns, weight);
+            const float *a = row + columns[0] * channels;
+            const float *b = row + columns[1] * channels;
+            const float *c = row + columns[2] * channels;
+#ifdef MIP_CHAIN_SSE2
+            if (channels == 4)
+            {
+                __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a), _mm_set1_ps(weight[0])), _mm_mul_ps(_mm_loadu_ps(b), _mm_set1_ps(weight[1])));
+                _mm_storeu_ps(out + x * 4, _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(c), _mm_set1_ps(weight[2]))));
+                continue;
+            }
+#endif
+            for (int k = 0; k < channels; ++k)
+                out[x * channels + k] = (a[k] * weight[0] + b[k] * weight[1]) + c[k] * weight[2];
+        }
+    }
+
+    // sRGB decode for every 8-bit value
+    static const float *srgbToLinear()
+    {
+        static const std::vector<float> table = []
+        {
+            std::vector<float> t(256);
+            for (int i = 0; i < 256; ++i)
+                t[i] = decode(i / 255.0f);
+            return t;
+        }();
+        return table.data();
+    }
+    // linear values where the rounded sRGB encoding steps from i-1 to i, so
+    // encoding is a search instead of a pow per channel
+    static const float *linearThresholds()
+    {
+        static const std::vector<float> table = []
+        {
+            std::vector<float> t(256);
+            t[0] = 0.0f;
+            for (int i = 1; i < 256; ++i)
+                t[i] = decode((i - 0.5f) / 255.0f);
+            return t;
+        }();
+        return table.data();
+    }
+    static float decode(float s)
+    {
+        return s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+    }
+    static unsigned char encode(float linear)
+    {
+        const float *threshold = linearThresholds();
+        int value = 0;
+        for (int step = 128; step; step >>= 1)
+            if (value + step < 256 && linear >= threshold[value + step])
+                value += step;
+        return (unsigned char)value;
+    }
+    static unsigned char quantize(float value)
+    {
+        value = value * 255.0f + 0.5f;
+        return (unsigned char)(value <= 0.0f ? 0 : value >= 255.0f ? 255 : (int)value);
+    }
+
+    std::vector<float> toLinear(const unsigned char *pixels, int width, int height, int colorChannels, bool hasAlpha) const
+    {
+        const float *table = srgbToLinear();
+        std::vector<float> out((size_t)width * height * channels);
+        for (size_t p = 0; p < (size_t)width * height; ++p)
+        {
+            const unsigned char *in = pixels + p * channels;
+            float *texel = &out[p * channels];
+            float alpha = hasAlpha ? in[colorChannels] / 255.0f : 1.0f;
+            for (int k = 0; k < colorChannels; ++k)
+                texel[k] = (srgb ? table[in[k]] : in[k] / 255.0f) * alpha;
+            if (hasAlpha)
+                texel[colorChannels] = alpha;
+        }
+        return out;
+    }
+    void fromLinear(unsigned char *out, const std::vector<float> &level, int colorChannels, bool hasAlpha) const
+    {
+        for (size_t p = 0; p < level.size() / channels; ++p)
+        {
+            const float *texel = &level[p * channels];
+            float alpha = hasAlpha ? texel[colorChannels] : 1.0f;
+            float scale = alpha > 0.0f ? 1.0f / alpha : 0.0f;
+            for (int k = 0; k < colorChannels; ++k)
+                out[p * channels + k] = srgb ? encode(texel[k] * scale) : quantize(texel[k] * scale);
+            if (hasAlpha)
+                out[p * channels + colorChannels] = quantize(alpha);
+        }
+    }
+};
+#endif
@@ -5,97 +5,165 @@
 
 #include <glm/glm.hpp>
 
+#include "GLHandle.h"
+#include "ShaderReflection.h"
+#include "ShaderSources.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+// 32-bit FNV-1a, usable at compile time
+constexpr uint32_t uniformHash(const char *name, size_t length, uint32_t hash = 2166136261u)
+{
+    return length ? uniformHash(name + 1, length - 1, (hash ^ (unsigned char)*name) * 16777619u) : hash;
+}
+
+// a uniform name hashed at compile time, written "projection"_u. the setters
+// taking one look the location up in a table the shader builds when it's
+// linked, so they neither allocate nor compare strings.
+struct UniformName
+{
+    uint32_t hash;
+    const char *name;   // kept for error messages and collision checks
+
+    constexpr UniformName(const char *name, size_t length)
+        : hash(uniformHash(name, length)), name(name) {}
+};
+
+constexpr UniformName operator"" _u(const char *name, size_t length)
+{
+    return UniformName(name, length);
+}
+
+// uniform uploads a Shader issued, and the ones it skipped because the
+// program already had the value
+struct UniformCounters
+{
+    unsigned int issued = 0;
+    unsigned int skipped = 0;
+};
+
 class Shader
 {
 public:
-    unsigned int ID;
+    GLProgram ID;
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure& e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-        }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
+        start(vertexPath, fragmentPath, geometryPath);
+        finish();
+    }
+    // tag for the constructor that only starts the compile and link. the
+    // shader can't be used until finish() has been called; ShaderCompiler
+    // calls it once the driver says the program is done.
+    struct Deferred {};
+    Shader(Deferred, const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    {
+        start(vertexPath, fragmentPath, geometryPath);
+    }
+    // tag for the constructor that starts compiling source text rather than
+    // files, e.g. a variant with defines added (see ShaderVariants.h). an
+    // empty geometryCode means no geometry shader. like Deferred, it needs
+    // finish() before use. retrievable asks the driver to keep the program
+    // binary around for glGetProgramBinary.
+    struct Source {};
+    Shader(Source, const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode = "",
+           bool retrievable = false)
+    {
+        start(vertexCode, fragmentCode, geometryCode, retrievable);
+    }
+    // tag for the constructor that takes over a program that's already
+    // linked, e.g. one loaded with glProgramBinary
+    struct Linked {};
+    Shader(Linked, GLuint program)
+    {
+        ID.reset(program);
+        buildUniformTable();
+        reflected = ShaderReflection(ID);
+    }
+    // report compile and link errors and get the program ready to use. this
+    // waits for the driver if it's still compiling.
+    // ------------------------------------------------------------------------
+    void finish()
+    {
+        if (!pending)
+            return;
+        pending = false;
         checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
         checkCompileErrors(fragment, "FRAGMENT");
-        // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
-        if(geometryPath != nullptr)
-        {
-            const char * gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
+        if(geometry)
             checkCompileErrors(geometry, "GEOMETRY");
-        }
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if(geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        buildUniformTable();
+        reflected = ShaderReflection(ID);
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-        if(geometryPath != nullptr)
+        if(geometry)
             glDeleteShader(geometry);
+    }
+    // take over fresh's program if it linked, for reloading a shader while
+    // the program runs. uniform values set through this shader and block
+    // bindings carry over to the new program, so call it between frames; a
+    // program that didn't link is retired and this one kept. fresh has to be
+    // finished, and is left without a program either way.
+    // ------------------------------------------------------------------------
+    bool replace(Shader &fresh)
+    {
+        GLint linked = GL_FALSE;
+        glGetProgramiv(fresh.ID, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            fresh.ID.reset();
+            return false;
+        }
+        for (const std::pair<std::string, unsigned int> &block : blockBindings)
+        {
+            GLuint index = glGetUniformBlockIndex(fresh.ID, block.first.c_str());
+            if (index != GL_INVALID_INDEX)
+                glUniformBlockBinding(fresh.ID, index, block.second);
+        }
+        fresh.blockBindings = blockBindings;
 
+        GLint current = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+        glUseProgram(fresh.ID);
+        std::vector<bool> copied(fresh.shadow.size(), false);
+        for (const Uniform &uniform : fresh.uniforms)
+        {
+            // an array's plain name shares its slot with the first element
+            if (copied[uniform.offset])
+                continue;
+            auto old = std::lower_bound(uniforms.begin(), uniforms.end(), uniform.hash,
+                                        [](const Uniform &entry, uint32_t hash) { return entry.hash < hash; });
+            if (old == uniforms.end() || old->hash != uniform.hash || old->bytes != uniform.bytes || old->type != uniform.type ||
+                !shadow[old->offset])
+                continue;
+            std::memcpy(&fresh.shadow[uniform.offset], &shadow[old->offset], sizeof(uint32_t) + uniform.bytes);
+            upload(uniform, &fresh.shadow[uniform.offset + sizeof(uint32_t)]);
+            copied[uniform.offset] = true;
+        }
+        glUseProgram((GLuint)current == ID ? fresh.ID.get() : (GLuint)current);
+        // the frames in flight still draw with the old program, which the
+        // handle retires to GLDeletionQueue
+        ID = std::move(fresh.ID);
+        uniforms.swap(fresh.uniforms);
+#ifndef NDEBUG
+        uniformNames.swap(fresh.uniformNames);
+#endif
+        byLocation.swap(fresh.byLocation);
+        shadow.swap(fresh.shadow);
+        // the blocks were bound above, the samplers set from the shadow copy
+        reflected = ShaderReflection(ID);
+        return true;
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -103,66 +171,471 @@ public:
     {
         glUseProgram(ID);
     }
-    // utility uniform functions
+    // point a uniform block at a binding point, where glBindBufferRange
+    // attaches its buffer. GLSL 3.30 has no layout(binding = n) for blocks.
+    // ------------------------------------------------------------------------
+    void bindBlock(const std::string &name, unsigned int binding)
+    {
+        GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index == GL_INVALID_INDEX)
+        {
+            std::cout << "ERROR::SHADER::UNIFORM_BLOCK_NOT_FOUND: " << name << std::endl;
+            return;
+        }
+        glUniformBlockBinding(ID, index, binding);
+        // remembered for replace()
+        blockBindings.push_back(std::make_pair(name, binding));
+        for (ShaderReflection::Block &block : reflected.blocks)
+            if (block.name == name)
+                block.binding = (GLint)binding;
+    }
+    // what the program reads, as it was linked (see ShaderReflection.h).
+    // block bindings set with bindBlock() are kept up to date; sampler units
+    // aren't, so ShaderReflection(ID) gives the current ones.
+    // ------------------------------------------------------------------------
+    const ShaderReflection &reflection() const
+    {
+        return reflected;
+    }
+    // utility uniform functions. the shader keeps a copy of every value it
+    // uploaded and skips uploads that wouldn't change anything, so the values
+    // must only be set through these while the shader is in use.
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        int data = (int)value;
+        if (changed(slotAt(location), &data, sizeof(data)))
+            glUniform1i(location, data);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &value, sizeof(value)))
+            glUniform1i(location, value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &value, sizeof(value)))
+            glUniform1f(location, value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &value[0], 2 * sizeof(float)))
+            glUniform2fv(location, 1, &value[0]);
     }
     void setVec2(const std::string &name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        const float data[] = { x, y };
+        if (changed(slotAt(location), data, sizeof(data)))
+            glUniform2fv(location, 1, data);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &value[0], 3 * sizeof(float)))
+            glUniform3fv(location, 1, &value[0]);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        const float data[] = { x, y, z };
+        if (changed(slotAt(location), data, sizeof(data)))
+            glUniform3fv(location, 1, data);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &value[0], 4 * sizeof(float)))
+            glUniform4fv(location, 1, &value[0]);
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w)
+    void setVec4(const std::string &name, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        const float data[] = { x, y, z, w };
+        if (changed(slotAt(location), data, sizeof(data)))
+            glUniform4fv(location, 1, data);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &mat[0][0], 4 * sizeof(float)))
+            glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &mat[0][0], 9 * sizeof(float)))
+            glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location = glGetUniformLocation(ID, name.c_str());
+        if (changed(slotAt(location), &mat[0][0], 16 * sizeof(float)))
+            glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // the same setters for hashed names. a name the program doesn't use is
+    // ignored, as GL ignores location -1.
+    // ------------------------------------------------------------------------
+    GLint location(UniformName name) const
+    {
+        int slot = find(name);
+        return slot < 0 ? -1 : uniforms[slot].location;
+    }
+    // ------------------------------------------------------------------------
+    void setBool(UniformName name, bool value) const
+    {
+        int slot = find(name);
+        int data = (int)value;
+        if (changed(slot, &data, sizeof(data)))
+            glUniform1i(uniforms[slot].location, data);
+    }
+    // ------------------------------------------------------------------------
+    void setInt(UniformName name, int value) const
+    {
+        int slot = find(name);
+        if (changed(slot, &value, sizeof(value)))
+            glUniform1i(uniforms[slot].location, value);
+    }
+    // ------------------------------------------------------------------------
+    void setFloat(UniformName name, float value) const
+    {
+        int slot = find(name);
+        if (changed(slot, &value, sizeof(value)))
+            glUniform1f(uniforms[slot].location, value);
+    }
+    // ------------------------------------------------------------------------
+    void setVec2(UniformName name, const glm::vec2 &value) const
+    {
+        int slot = find(name);
+        if (changed(slot, &value[0], 2 * sizeof(float)))
+            glUniform2fv(uniforms[slot].location, 1, &value[0]);
+    }
+    void setVec2(UniformName name, float x, float y) const
+    {
+        int slot = find(name);
+        const float data[] = { x, y };
+        if (changed(slot, data, sizeof(data)))
+            glUniform2fv(uniforms[slot].location, 1, data);
+    }
+    // ------------------------------------------------------------------------
+    void setVec3(UniformName name, const glm::vec3 &value) const
+    {
+        int slot = find(name);
+        if (changed(slot, &value[0], 3 * sizeof(float)))
+            glUniform3fv(uniforms[slot].location, 1, &value[0]);
+    }
+    void setVec3(UniformName name, float x, float y, float z) const
+    {
+        int slot = find(name);
+        const float data[] = { x, y, z };
+        if (changed(slot, data, sizeof(data)))
+            glUniform3fv(uniforms[slot].location, 1, data);
+    }
+    // ------------------------------------------------------------------------
+    void setVec4(UniformName name, const glm::vec4 &value) const
+    {
+        int slot = find(name);
+        if (changed(slot, &value[0], 4 * sizeof(float)))
+            glUniform4fv(uniforms[slot].location, 1, &value[0]);
+    }
+    void setVec4(UniformName name, float x, float y, float z, float w) const
+    {
+        int slot = find(name);
+        const float data[] = { x, y, z, w };
+        if (changed(slot, data, sizeof(data)))
+            glUniform4fv(uniforms[slot].location, 1, data);
+    }
+    // ------------------------------------------------------------------------
+    void setMat2(UniformName name, const glm::mat2 &mat) const
+    {
+        int slot = find(name);
+        if (changed(slot, &mat[0][0], 4 * sizeof(float)))
+            glUniformMatrix2fv(uniforms[slot].location, 1, GL_FALSE, &mat[0][0]);
+    }
+    // ------------------------------------------------------------------------
+    void setMat3(UniformName name, const glm::mat3 &mat) const
+    {
+        int slot = find(name);
+        if (changed(slot, &mat[0][0], 9 * sizeof(float)))
+            glUniformMatrix3fv(uniforms[slot].location, 1, GL_FALSE, &mat[0][0]);
+    }
+    // ------------------------------------------------------------------------
+    void setMat4(UniformName name, const glm::mat4 &mat) const
+    {
+        int slot = find(name);
+        if (changed(slot, &mat[0][0], 16 * sizeof(float)))
+            glUniformMatrix4fv(uniforms[slot].location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // uploads issued and skipped as unchanged since the last reset; reset
+    // once a frame for per-frame numbers
+    // ------------------------------------------------------------------------
+    const UniformCounters &uniformCounters() const
+    {
+        return counters;
+    }
+    void resetUniformCounters()
+    {
+        counters = UniformCounters();
     }
 
 private:
+    unsigned int vertex = 0;
+    unsigned int fragment = 0;
+    unsigned int geometry = 0;
+    bool pending = false;   // started but not finished
+
+    void start(const char* vertexPath, const char* fragmentPath, const char* geometryPath)
+    {
+        // 1. retrieve the vertex/fragment source code from filePath, with
+        // includes resolved. files shared between programs are only read once.
+        std::shared_ptr<const std::string> vertexCode = ShaderSources::shared().get(vertexPath);
+        std::shared_ptr<const std::string> fragmentCode = ShaderSources::shared().get(fragmentPath);
+        std::shared_ptr<const std::string> geometryCode;
+        // if geometry shader path is present, also load a geometry shader
+        if(geometryPath != nullptr)
+            geometryCode = ShaderSources::shared().get(geometryPath);
+        start(*vertexCode, *fragmentCode, geometryCode ? *geometryCode : std::string(), false);
+    }
+    void start(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode, bool retrievable)
+    {
+        // the sources go to the driver with their lengths, straight from
+        // the strings
+        const char* vShaderCode = vertexCode.data();
+        const char * fShaderCode = fragmentCode.data();
+        GLint vLength = (GLint)vertexCode.size();
+        GLint fLength = (GLint)fragmentCode.size();
+        // 2. compile shaders, without asking how it went: that would wait
+        // for the driver, which may be compiling on threads of its own
+        // vertex shader
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, &vLength);
+        glCompileShader(vertex);
+        // fragment Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, &fLength);
+        glCompileShader(fragment);
+        // if geometry shader is given, compile geometry shader
+        if(!geometryCode.empty())
+        {
+            const char * gShaderCode = geometryCode.data();
+            GLint gLength = (GLint)geometryCode.size();
+            geometry = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(geometry, 1, &gShaderCode, &gLength);
+            glCompileShader(geometry);
+        }
+        // shader Program
+        ID = GLProgram::create();
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        if(geometry)
+            glAttachShader(ID, geometry);
+        if(retrievable)
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        pending = true;
+    }
+
+    struct Uniform
+    {
+        uint32_t hash;
+        GLint location;
+        uint32_t offset;    // of the value's shadow copy, after a set flag
+        uint32_t bytes;
+        GLenum type;
+    };
+    // sorted by hash for the hashed setters
+    std::vector<Uniform> uniforms;
+#ifndef NDEBUG
+    std::vector<std::string> uniformNames;
+#endif
+    // slots sorted by location, for the setters taking strings
+    std::vector<std::pair<GLint, int>> byLocation;
+    // the last value uploaded to every uniform. an array's plain name and its
+    // first element share theirs.
+    mutable std::vector<unsigned char> shadow;
+    mutable UniformCounters counters;
+    std::vector<std::pair<std::string, unsigned int>> blockBindings;
+    ShaderReflection reflected;
+
+    int find(UniformName name) const
+    {
+        auto found = std::lower_bound(uniforms.begin(), uniforms.end(), name.hash,
+                                      [](const Uniform &uniform, uint32_t hash) { return uniform.hash < hash; });
+        if (found == uniforms.end() || found->hash != name.hash)
+            return -1;
+#ifndef NDEBUG
+        if (uniformNames[found - uniforms.begin()] != name.name)
+        {
+            std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION: " << name.name << " and " << uniformNames[found - uniforms.begin()] << std::endl;
+            return -1;
+        }
+#endif
+        return (int)(found - uniforms.begin());
+    }
+    int slotAt(GLint location) const
+    {
+        auto found = std::lower_bound(byLocation.begin(), byLocation.end(), std::make_pair(location, -1));
+        return found != byLocation.end() && found->first == location ? found->second : -1;
+    }
+    // whether value differs from the slot's last upload; if so it becomes
+    // the last upload. a value of the wrong size for the uniform is passed on
+    // untracked for GL to report.
+    bool changed(int slot, const void *value, size_t bytes) const
+    {
+        if (slot < 0)
+            return false;
+        const Uniform &uniform = uniforms[slot];
+        if (bytes != uniform.bytes)
+            return true;
+        unsigned char *set = &shadow[uniform.offset];
+        unsigned char *copy = set + sizeof(uint32_t);
+        if (*set && std::memcmp(copy, value, bytes) == 0)
+        {
+            ++counters.skipped;
+            return false;
+        }
+        *set = 1;
+        std::memcpy(copy, value, bytes);
+        ++counters.issued;
+        return true;
+    }
+    // bytes of one value of a uniform type as the setters pass it
+    static uint32_t uniformBytes(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2:
+            return 8;
+        case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3:
+            return 12;
+        case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2:
+            return 16;
+        case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2:
+            return 24;
+        case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2:
+            return 32;
+        case GL_FLOAT_MAT3:
+            return 36;
+        case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3:
+            return 48;
+        case GL_FLOAT_MAT4:
+            return 64;
+        default:
+            // scalars and samplers
+            return 4;
+        }
+    }
+
+    // upload a value from the shadow copy with the call for its type
+    static void upload(const Uniform &uniform, const unsigned char *value)
+    {
+        const GLfloat *f = (const GLfloat *)value;
+        const GLint *i = (const GLint *)value;
+        const GLuint *u = (const GLuint *)value;
+        switch (uniform.type)
+        {
+        case GL_FLOAT: glUniform1fv(uniform.location, 1, f); break;
+        case GL_FLOAT_VEC2: glUniform2fv(uniform.location, 1, f); break;
+        case GL_FLOAT_VEC3: glUniform3fv(uniform.location, 1, f); break;
+        case GL_FLOAT_VEC4: glUniform4fv(uniform.location, 1, f); break;
+        case GL_INT_VEC2: case GL_BOOL_VEC2: glUniform2iv(uniform.location, 1, i); break;
+        case GL_INT_VEC3: case GL_BOOL_VEC3: glUniform3iv(uniform.location, 1, i); break;
+        case GL_INT_VEC4: case GL_BOOL_VEC4: glUniform4iv(uniform.location, 1, i); break;
+        case GL_UNSIGNED_INT: glUniform1uiv(uniform.location, 1, u); break;
+        case GL_UNSIGNED_INT_VEC2: glUniform2uiv(uniform.location, 1, u); break;
+        case GL_UNSIGNED_INT_VEC3: glUniform3uiv(uniform.location, 1, u); break;
+        case GL_UNSIGNED_INT_VEC4: glUniform4uiv(uniform.location, 1, u); break;
+        case GL_FLOAT_MAT2: glUniformMatrix2fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT3: glUniformMatrix3fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT4: glUniformMatrix4fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT2x3: glUniformMatrix2x3fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT3x2: glUniformMatrix3x2fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT2x4: glUniformMatrix2x4fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT4x2: glUniformMatrix4x2fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT3x4: glUniformMatrix3x4fv(uniform.location, 1, GL_FALSE, f); break;
+        case GL_FLOAT_MAT4x3: glUniformMatrix4x3fv(uniform.location, 1, GL_FALSE, f); break;
+        default:
+            // ints, bools and samplers
+            glUniform1iv(uniform.location, 1, i);
+            break;
+        }
+    }
+
+    // hash every active uniform's name once the program is linked and give
+    // it room for a shadow copy. arrays are entered under their plain name
+    // and under each element's name.
+    // ------------------------------------------------------------------------
+    void buildUniformTable()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<std::pair<Uniform, std::string>> found;
+        std::vector<char> buffer(std::max(maxLength, 1));
+        uint32_t shadowBytes = 0;
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), nullptr, &size, &type, buffer.data());
+            std::string name = buffer.data();
+            // uniform block members have no location
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            if (location < 0)
+                continue;
+            bool array = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0;
+            std::string base = array ? name.substr(0, name.size() - 3) : name;
+            uint32_t bytes = uniformBytes(type);
+            uint32_t slotBytes = sizeof(uint32_t) + (bytes + 3) / 4 * 4;
+            found.push_back(std::make_pair(Uniform{ uniformHash(base.data(), base.size()), location, shadowBytes, bytes, type }, base));
+            for (GLint element = 0; array && element < size; ++element)
+            {
+                std::string elementName = base + "[" + std::to_string(element) + "]";
+                found.push_back(std::make_pair(Uniform{ uniformHash(elementName.data(), elementName.size()),
+                                                        glGetUniformLocation(ID, elementName.c_str()), shadowBytes, bytes, type }, elementName));
+                shadowBytes += slotBytes;
+            }
+            if (!array)
+                shadowBytes += slotBytes;
+        }
+        std::sort(found.begin(), found.end(), [](const std::pair<Uniform, std::string> &a, const std::pair<Uniform, std::string> &b)
+        {
+            return a.first.hash < b.first.hash;
+        });
+        uniforms.clear();
+        for (size_t i = 0; i < found.size(); ++i)
+        {
+            if (i > 0 && found[i].first.hash == found[i - 1].first.hash)
+            {
+                // two names of one program hash alike; rename one of them
+                std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION: " << found[i].second << " and " << found[i - 1].second << std::endl;
+                continue;
+            }
+            uniforms.push_back(found[i].first);
+#ifndef NDEBUG
+            uniformNames.push_back(found[i].second);
+#endif
+        }
+        byLocation.clear();
+        for (size_t slot = 0; slot < uniforms.size(); ++slot)
+            byLocation.push_back(std::make_pair(uniforms[slot].location, (int)slot));
+        std::sort(byLocation.begin(), byLocation.end());
+        shadow.assign(shadowBytes, 0);
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -175,7 +648,7 @@ private:
             if(!success)
             {
                 glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << ShaderSources::shared().describe(infoLog) << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
         else
@@ -0,0 +1,264 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include "Shader.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <iostream>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// a shader being compiled by a ShaderCompiler. ready() never blocks, so the
+// render loop can poll it; get() waits for the shader if it has to.
+class ShaderFuture
+{
+public:
+    ShaderFuture() {}
+
+    // whether get() would return without waiting. with
+    // GL_KHR_parallel_shader_compile this asks the driver, so call it on the
+    // thread that owns the context.
+    // ------------------------------------------------------------------------
+    bool ready()
+    {
+        if (!state)
+            return false;
+        if (state->onWorker)
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            return state->done;
+        }
+        if (!state->done)
+        {
+            // without the extension there's no asking without waiting, so
+            // the first question finishes the shader
+            GLint complete = GL_TRUE;
+            if (state->poll)
+                glGetProgramiv(state->shader->ID, GL_COMPLETION_STATUS_KHR, &complete);
+            if (complete)
+                finish();
+        }
+        return state->done;
+    }
+    // the shader, once it's compiled and linked
+    // ------------------------------------------------------------------------
+    Shader &get()
+    {
+        if (!state->onWorker)
+            finish();
+        else
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->finished.wait(lock, [this] { return state->done; });
+        }
+        return *state->shader;
+    }
+    // like get(), but hands the shader over, leaving the future empty
+    // ------------------------------------------------------------------------
+    std::unique_ptr<Shader> take()
+    {
+        get();
+        std::unique_ptr<Shader> shader = std::move(state->shader);
+        state.reset();
+        return shader;
+    }
+    bool valid() const
+    {
+        return (bool)state;
+    }
+
+private:
+    friend class ShaderCompiler;
+    struct State
+    {
+        bool onWorker = false;  // built by the worker rather than on this thread
+        bool poll = false;      // GL_COMPLETION_STATUS_KHR can be asked
+        std::unique_ptr<Shader> shader;
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done = false;
+    };
+    std::shared_ptr<State> state;
+
+    void finish()
+    {
+        state->shader->finish();
+        state->done = true;
+    }
+};
+
+// compiles and links shaders without making the caller wait: every program
+// is started up front and the futures say when each is ready, so the driver
+// can work on them side by side and the caller can get on with loading
+// textures in the meantime.
+//
+// drivers with GL_KHR_parallel_shader_compile compile on threads of their
+// own; the program is only checked once GL_COMPLETION_STATUS_KHR says it's
+// done. other drivers compile on the calling thread, where checking the
+// first result waits for it, unless a worker context is given: a callback
+// run on a worker thread that makes current a context sharing objects with
+// the render context (e.g. one made with SDL_GL_SHARE_WITH_CURRENT_CONTEXT)
+// and returns whether it could. the context needs a surface of its own, as
+// EGL won't make one surface current on two threads. the worker then builds
+// the shaders in that context instead; if the callback fails, they're
+// built on the calling thread as without one.
+class ShaderCompiler
+{
+public:
+    explicit ShaderCompiler(std::function<bool()> workerContext = nullptr)
+    {
+        parallel = parallelSupported();
+        if (!parallel && workerContext)
+        {
+            worker = std::thread(&ShaderCompiler::work, this, workerContext);
+            // a worker without a context would only make dead programs
+            std::unique_lock<std::mutex> lock(mutex);
+            started.wait(lock, [this] { return workerStarted; });
+            if (!workerCurrent)
+            {
+                lock.unlock();
+                worker.join();
+                std::cout << "ERROR::SHADER_COMPILER::NO_WORKER_CONTEXT" << std::endl;
+            }
+        }
+    }
+    ~ShaderCompiler()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+    }
+
+    // whether the current context compiles in the background by itself
+    // ------------------------------------------------------------------------
+    static bool parallelSupported()
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const char *name = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+            if (name && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 ||
+                         std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+                return true;
+        }
+        return false;
+    }
+
+    // start compiling a program; an empty geometryPath means none
+    // ------------------------------------------------------------------------
+    ShaderFuture compile(const std::string &vertexPath, const std::string &fragmentPath, const std::string &geometryPath = "")
+    {
+        return start([vertexPath, fragmentPath, geometryPath](bool finished)
+        {
+            const char *geometry = geometryPath.empty() ? nullptr : geometryPath.c_str();
+            if (finished)
+                return std::unique_ptr<Shader>(new Shader(vertexPath.c_str(), fragmentPath.c_str(), geometry));
+            return std::unique_ptr<Shader>(new Shader(Shader::Deferred(), vertexPath.c_str(), fragmentPath.c_str(), geometry));
+        });
+    }
+    // the same for source text, as Shader's Source constructor takes it
+    // ------------------------------------------------------------------------
+    ShaderFuture compileSource(const std::string &vertexCode, const std::string &fragmentCode, const std::string &geometryCode = "",
+                               bool retrievable = false)
+    {
+        return start([vertexCode, fragmentCode, geometryCode, retrievable](bool finished)
+        {
+            std::unique_ptr<Shader> shader(new Shader(Shader::Source(), vertexCode, fragmentCode, geometryCode, retrievable));
+            if (finished)
+                shader->finish();
+            return shader;
+        });
+    }
+
+private:
+    // makes the shader, finished or only started
+    typedef std::function<std::unique_ptr<Shader>(bool finished)> Build;
+    struct Job
+    {
+        Build build;
+        std::shared_ptr<ShaderFuture::State> state;
+    };
+
+    bool parallel = false;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable started;
+    std::deque<Job> jobs;
+    bool stopping = false;
+    bool workerStarted = false;
+    bool workerCurrent = false;
+
+    ShaderFuture start(Build build)
+    {
+        ShaderFuture future;
+        future.state = std::make_shared<ShaderFuture::State>();
+        if (worker.joinable())
+        {
+            future.state->onWorker = true;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(Job{ std::move(build), future.state });
+            }
+            wake.notify_one();
+            return future;
+        }
+        // with the extension the driver compiles in the background; without
+        // it glCompileShader may still return early, and ready() or get()
+        // wait for whatever is left
+        future.state->poll = parallel;
+        future.state->shader = build(false);
+        return future;
+    }
+
+    void work(std::function<bool()> workerContext)
+    {
+        bool current = workerContext();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            workerStarted = true;
+            workerCurrent = current;
+        }
+        started.notify_all();
+        if (!current)
+            return;
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            std::unique_ptr<Shader> shader = job.build(true);
+            // the program has to be complete before another context uses it
+            glFinish();
+            {
+                std::lock_guard<std::mutex> lock(job.state->mutex);
+                job.state->shader = std::move(shader);
+                job.state->done = true;
+            }
+            job.state->finished.notify_all();
+        }
+    }
+};
+#endif
@@ -0,0 +1,245 @@
+#ifndef SHADER_PIPELINE_H
+#define SHADER_PIPELINE_H
+
+#include "Shader.h"
+#include "ShaderSources.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <iostream>
+
+// a vertex stage and a fragment stage, each a separable program of its own,
+// bound together at draw time instead of linked into one program. n vertex
+// shaders and m fragment shaders then cost n + m compiles and links rather
+// than n * m.
+//
+// the stages are Shaders made with Shader::Linked, so uniforms are set with
+// their setters as usual, on the stage that declares them, after calling
+// uniforms() with it; use() binds the pipeline, and Shader::use() must not
+// be called on a stage. the interface between the stages is checked once,
+// when the pipeline is made, rather than on every draw.
+class ShaderPipeline
+{
+public:
+    GLProgramPipeline ID;
+
+    ShaderPipeline(Shader &vertex, Shader &fragment)
+        : vertex(vertex), fragment(fragment)
+    {
+        ID = GLProgramPipeline::create();
+        glUseProgramStages(ID, GL_VERTEX_SHADER_BIT, vertex.ID);
+        glUseProgramStages(ID, GL_FRAGMENT_SHADER_BIT, fragment.ID);
+        validated = matchInterface() && validate();
+    }
+
+    // bind the pipeline. a program made current with glUseProgram would
+    // take its place, so none is.
+    // ------------------------------------------------------------------------
+    void use() const
+    {
+        glUseProgram(0);
+        glBindProgramPipeline(ID);
+    }
+    // point the uniform setters at one of the stages, while the pipeline is
+    // bound; returns the stage to call them on
+    // ------------------------------------------------------------------------
+    Shader &uniforms(Shader &stage) const
+    {
+        glActiveShaderProgram(ID, stage.ID);
+        return stage;
+    }
+    // whether both stages linked and fit together
+    bool valid() const
+    {
+        return validated;
+    }
+
+private:
+    Shader &vertex;
+    Shader &fragment;
+    bool validated = false;
+
+    struct Variable
+    {
+        std::string name;
+        GLint type;
+        GLint location;
+    };
+    static std::vector<Variable> variables(GLuint program, GLenum interface)
+    {
+        std::vector<Variable> found;
+        GLint count = 0, maxLength = 0;
+        glGetProgramInterfaceiv(program, interface, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(program, interface, GL_MAX_NAME_LENGTH, &maxLength);
+        std::vector<char> name(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; ++i)
+        {
+            glGetProgramResourceName(program, interface, (GLuint)i, (GLsizei)name.size(), nullptr, name.data());
+            // built-ins like gl_Position and gl_FragCoord always match
+            if (std::strncmp(name.data(), "gl_", 3) == 0)
+                continue;
+            const GLenum properties[] = { GL_TYPE, GL_LOCATION };
+            GLint values[2];
+            glGetProgramResourceiv(program, interface, (GLuint)i, 2, properties, 2, nullptr, values);
+            found.push_back({ name.data(), values[0], values[1] });
+        }
+        return found;
+    }
+
+    // every fragment input needs a vertex output of the same type, matched by
+    // location if the input has one and by name otherwise. the driver leaves
+    // a mismatch undefined rather than reporting it.
+    bool matchInterface() const
+    {
+        GLint vertexLinked = GL_FALSE, fragmentLinked = GL_FALSE;
+        glGetProgramiv(vertex.ID, GL_LINK_STATUS, &vertexLinked);
+        glGetProgramiv(fragment.ID, GL_LINK_STATUS, &fragmentLinked);
+        if (!vertexLinked || !fragmentLinked)
+        {
+            std::cout << "ERROR::SHADER_PIPELINE::STAGE_NOT_LINKED" << std::endl;
+            return false;
+        }
+        std::vector<Variable> outputs = variables(vertex.ID, GL_PROGRAM_OUTPUT);
+        bool matched = true;
+        for (const Variable &input : variables(fragment.ID, GL_PROGRAM_INPUT))
+        {
+            const Variable *output = nullptr;
+            for (const Variable &candidate : outputs)
+                if (input.location >= 0 ? candidate.location == input.location : candidate.name == input.name)
+                    output = &candidate;
+            if (!output || output->type != input.type)
+            {
+                std::cout << "ERROR::SHADER_PIPELINE::INTERFACE_MISMATCH: " << input.name
+                          << (output ? " has another type in the vertex stage" : " isn't written by the vertex stage") << std::endl;
+                matched = false;
+            }
+        }
+        return matched;
+    }
+
+    bool validate() const
+    {
+        glValidateProgramPipeline(ID);
+        GLint status = GL_FALSE;
+        glGetProgramPipelineiv(ID, GL_VALIDATE_STATUS, &status);
+        if (!status)
+        {
+            GLchar infoLog[1024] = "";
+            glGetProgramPipelineInfoLog(ID, sizeof(infoLog), nullptr, infoLog);
+            std::cout << "ERROR::SHADER_PIPELINE::VALIDATION_FAILED\n" << infoLog << std::endl;
+        }
+        return status != GL_FALSE;
+    }
+};
+
+// separable stages compiled once each, from files read through
+// ShaderSources, and the pipelines made from them. needs GLES 3.1, or on
+// desktop GL both GL_ARB_separate_shader_objects (core in 4.1) and, for
+// checking the interface between stages, GL_ARB_program_interface_query
+// (core in 4.3); supported() says whether the current context has them.
+class ShaderStages
+{
+public:
+    struct Stats
+    {
+        int stages = 0;
+        int pipelines = 0;
+    };
+
+    ShaderStages() {}
+
+    // ------------------------------------------------------------------------
+    static bool supported()
+    {
+        const char *version = (const char *)glGetString(GL_VERSION);
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        int number = major * 10 + minor;
+        if (version && std::strncmp(version, "OpenGL ES", 9) == 0)
+            return number >= 31;
+        bool separate = number >= 41 || extension("GL_ARB_separate_shader_objects");
+        bool interfaceQuery = number >= 43 || extension("GL_ARB_program_interface_query");
+        return separate && interfaceQuery;
+    }
+
+    // the stage of the given type (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER)
+    // compiled from path with defines, made the first time it's asked for
+    // ------------------------------------------------------------------------
+    Shader &stage(GLenum type, const std::string &path, const std::vector<std::string> &defines = std::vector<std::string>())
+    {
+        std::string name = std::to_string(type) + ":" + path;
+        std::string lines;
+        for (const std::string &define : defines)
+        {
+            name += ":" + define;
+            lines += "#define " + define + " 1\n";
+        }
+        std::unique_ptr<Shader> &found = stages[name];
+        if (!found)
+        {
+            found.reset(new Shader(Shader::Linked(), compile(type, path, lines)));
+            ++counters.stages;
+        }
+        return *found;
+    }
+    // the pipeline of two stages from stage(), made the first time
+    // ------------------------------------------------------------------------
+    ShaderPipeline &pipeline(Shader &vertex, Shader &fragment)
+    {
+        std::unique_ptr<ShaderPipeline> &found = pipelines[std::make_pair(vertex.ID.get(), fragment.ID.get())];
+        if (!found)
+        {
+            found.reset(new ShaderPipeline(vertex, fragment));
+            ++counters.pipelines;
+        }
+        return *found;
+    }
+
+    const Stats &stats() const
+    {
+        return counters;
+    }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<Shader>> stages;
+    std::map<std::pair<GLuint, GLuint>, std::unique_ptr<ShaderPipeline>> pipelines;
+    Stats counters;
+
+    static bool extension(const char *wanted)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const char *name = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+            if (name && std::strcmp(name, wanted) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // compile and link in one go; the compile log ends up in the program's
+    static GLuint compile(GLenum type, const std::string &path, const std::string &defines)
+    {
+        std::string source = ShaderSources::withDefines(*ShaderSources::shared().get(path), defines);
+        const char *code = source.c_str();
+        GLuint program = glCreateShaderProgramv(type, 1, &code);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            GLchar infoLog[1024] = "";
+            glGetProgramInfoLog(program, sizeof(infoLog), nullptr, infoLog);
+            std::cout << "ERROR::SHADER_PIPELINE::STAGE_FAILED: " << path << "\n"
+                      << ShaderSources::shared().describe(infoLog) << "\n -- --------------------------------------------------- -- " << std::endl;
+        }
+        return program;
+    }
+};
+#endif
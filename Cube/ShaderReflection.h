@@ -0,0 +1,332 @@
+#ifndef SHADER_REFLECTION_H
+#define SHADER_REFLECTION_H
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// one attribute of a vertex buffer's layout, found in programs by name
+struct VertexAttribute
+{
+    const char *name;
+    GLint components;
+    GLenum type;
+    size_t offset;
+};
+
+// what a linked program reads: its active attributes, uniforms, uniform
+// blocks and samplers, with the types, locations and layouts the driver gave
+// them. Shader builds one when it's linked, so vertex layouts and materials
+// can be matched to the program once, at load time, rather than looked up on
+// every draw. json() writes it out for tools.
+class ShaderReflection
+{
+public:
+    struct Attribute
+    {
+        std::string name;
+        GLenum type;
+        GLint size;         // array length, 1 if it's not an array
+        GLint location;
+    };
+    struct Uniform
+    {
+        std::string name;   // arrays as name[0]
+        GLenum type;
+        GLint size;         // array length, 1 if it's not an array
+        GLint location;     // -1 in a block
+        GLint block;        // index into blocks, -1 in the default block
+        GLint offset;       // bytes into the block; -1 in the default block
+        GLint arrayStride;
+        GLint matrixStride;
+    };
+    struct Block
+    {
+        std::string name;
+        GLint binding;
+        GLint size;         // bytes of buffer the block reads
+        std::vector<int> members;   // indices into uniforms
+    };
+    struct Sampler
+    {
+        std::string name;
+        GLenum type;
+        GLint location;
+        GLint unit;         // the texture unit it reads, as last set
+    };
+
+    std::vector<Attribute> attributes;
+    std::vector<Uniform> uniforms;
+    std::vector<Block> blocks;
+    std::vector<Sampler> samplers;
+
+    ShaderReflection() {}
+    explicit ShaderReflection(GLuint program)
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+        glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+        std::vector<char> name(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; ++i)
+        {
+            Attribute attribute;
+            glGetActiveAttrib(program, (GLuint)i, (GLsizei)name.size(), nullptr, &attribute.size, &attribute.type, name.data());
+            attribute.name = name.data();
+            attribute.location = glGetAttribLocation(program, name.data());
+            attributes.push_back(attribute);
+        }
+
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+        name.assign(std::max(maxLength, 1), 0);
+        for (GLint i = 0; i < count; ++i)
+        {
+            Block block;
+            glGetActiveUniformBlockName(program, (GLuint)i, (GLsizei)name.size(), nullptr, name.data());
+            block.name = name.data();
+            glGetActiveUniformBlockiv(program, (GLuint)i, GL_UNIFORM_BLOCK_BINDING, &block.binding);
+            glGetActiveUniformBlockiv(program, (GLuint)i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.size);
+            blocks.push_back(block);
+        }
+
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        name.assign(std::max(maxLength, 1), 0);
+        std::vector<GLuint> indices(count);
+        for (GLint i = 0; i < count; ++i)
+            indices[i] = (GLuint)i;
+        std::vector<GLint> block(count), offset(count), arrayStride(count), matrixStride(count);
+        if (count)
+        {
+            glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_BLOCK_INDEX, block.data());
+            glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_OFFSET, offset.data());
+            glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_ARRAY_STRIDE, arrayStride.data());
+            glGetActiveUniformsiv(program, count, indices.data(), GL_UNIFORM_MATRIX_STRIDE, matrixStride.data());
+        }
+        for (GLint i = 0; i < count; ++i)
+        {
+            Uniform uniform;
+            glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), nullptr, &uniform.size, &uniform.type, name.data());
+            uniform.name = name.data();
+            uniform.location = glGetUniformLocation(program, name.data());
+            uniform.block = block[i];
+            uniform.offset = offset[i];
+            uniform.arrayStride = arrayStride[i];
+            uniform.matrixStride = matrixStride[i];
+            if (uniform.block >= 0 && uniform.block < (GLint)blocks.size())
+                blocks[uniform.block].members.push_back((int)uniforms.size());
+            if (isSampler(uniform.type))
+            {
+                // an array of samplers reads a unit per element
+                for (GLint element = 0; element < uniform.size; ++element)
+                {
+                    std::string elementName = uniform.size > 1 ? uniform.name.substr(0, uniform.name.rfind('[')) + "[" + std::to_string(element) + "]"
+                                                               : uniform.name;
+                    Sampler entry{ elementName, uniform.type, glGetUniformLocation(program, elementName.c_str()), 0 };
+                    glGetUniformiv(program, entry.location, &entry.unit);
+                    samplers.push_back(entry);
+                }
+            }
+            uniforms.push_back(uniform);
+        }
+    }
+
+    // lookups by name; null if the program doesn't use it
+    // ------------------------------------------------------------------------
+    const Attribute *attribute(const std::string &name) const
+    {
+        return byName(attributes, name);
+    }
+    const Uniform *uniform(const std::string &name) const
+    {
+        return byName(uniforms, name);
+    }
+    const Block *block(const std::string &name) const
+    {
+        return byName(blocks, name);
+    }
+    const Sampler *sampler(const std::string &name) const
+    {
+        return byName(samplers, name);
+    }
+
+    // the location of every attribute of a vertex layout, or -1 for the ones
+    // the program doesn't read, to set the layout up with once. an attribute
+    // the program reads but the layout lacks is an error.
+    // ------------------------------------------------------------------------
+    std::vector<GLint> locations(const VertexAttribute *layout, size_t count) const
+    {
+        std::vector<GLint> found;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Attribute *attribute = this->attribute(layout[i].name);
+            found.push_back(attribute ? attribute->location : -1);
+        }
+        for (const Attribute &attribute : attributes)
+        {
+            bool provided = attribute.name.compare(0, 3, "gl_") == 0;
+            for (size_t i = 0; i < count && !provided; ++i)
+                provided = attribute.name == layout[i].name;
+            if (!provided)
+                std::cout << "ERROR::SHADER_REFLECTION::ATTRIBUTE_NOT_IN_LAYOUT: " << attribute.name << std::endl;
+        }
+        return found;
+    }
+    template <size_t N>
+    std::vector<GLint> locations(const VertexAttribute (&layout)[N]) const
+    {
+        return locations(layout, N);
+    }
+
+    // the record as a JSON object, GLSL type names and all
+    // ------------------------------------------------------------------------
+    std::string json() const
+    {
+        std::string out = "{\n  \"attributes\": [";
+        for (size_t i = 0; i < attributes.size(); ++i)
+        {
+            const Attribute &a = attributes[i];
+            out += std::string(i ? "," : "") + "\n    { \"name\": " + quote(a.name) + ", \"type\": " + quote(typeName(a.type)) +
+                   ", \"size\": " + std::to_string(a.size) + ", \"location\": " + std::to_string(a.location) + " }";
+        }
+        out += "\n  ],\n  \"uniforms\": [";
+        for (size_t i = 0; i < uniforms.size(); ++i)
+        {
+            const Uniform &u = uniforms[i];
+            out += std::string(i ? "," : "") + "\n    { \"name\": " + quote(u.name) + ", \"type\": " + quote(typeName(u.type)) +
+                   ", \"size\": " + std::to_string(u.size) + ", \"location\": " + std::to_string(u.location) +
+                   ", \"block\": " + (u.block >= 0 && u.block < (GLint)blocks.size() ? quote(blocks[u.block].name) : "null") +
+                   ", \"offset\": " + std::to_string(u.offset) + ", \"arrayStride\": " + std::to_string(u.arrayStride) +
+                   ", \"matrixStride\": " + std::to_string(u.matrixStride) + " }";
+        }
+        out += "\n  ],\n  \"blocks\": [";
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            const Block &b = blocks[i];
+            out += std::string(i ? "," : "") + "\n    { \"name\": " + quote(b.name) + ", \"binding\": " + std::to_string(b.binding) +
+                   ", \"size\": " + std::to_string(b.size) + ", \"members\": [";
+            for (size_t m = 0; m < b.members.size(); ++m)
+                out += std::string(m ? ", " : "") + quote(uniforms[b.members[m]].name);
+            out += "] }";
+        }
+        out += "\n  ],\n  \"samplers\": [";
+        for (size_t i = 0; i < samplers.size(); ++i)
+        {
+            const Sampler &s = samplers[i];
+            out += std::string(i ? "," : "") + "\n    { \"name\": " + quote(s.name) + ", \"type\": " + quote(typeName(s.type)) +
+                   ", \"location\": " + std::to_string(s.location) + ", \"unit\": " + std::to_string(s.unit) + " }";
+        }
+        out += "\n  ]\n}\n";
+        return out;
+    }
+    // ------------------------------------------------------------------------
+    bool save(const std::string &path) const
+    {
+        std::string text = json();
+        FILE *out = std::fopen(path.c_str(), "w");
+        bool ok = out && std::fwrite(text.data(), 1, text.size(), out) == text.size();
+        if (out)
+            ok = std::fclose(out) == 0 && ok;
+        if (!ok)
+            std::cout << "ERROR::SHADER_REFLECTION::FAILED_TO_WRITE: " << path << std::endl;
+        return ok;
+    }
+
+    // the GLSL name of a type
+    // ------------------------------------------------------------------------
+    static std::string typeName(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_FLOAT: return "float";
+        case GL_FLOAT_VEC2: return "vec2";
+        case GL_FLOAT_VEC3: return "vec3";
+        case GL_FLOAT_VEC4: return "vec4";
+        case GL_INT: return "int";
+        case GL_INT_VEC2: return "ivec2";
+        case GL_INT_VEC3: return "ivec3";
+        case GL_INT_VEC4: return "ivec4";
+        case GL_UNSIGNED_INT: return "uint";
+        case GL_UNSIGNED_INT_VEC2: return "uvec2";
+        case GL_UNSIGNED_INT_VEC3: return "uvec3";
+        case GL_UNSIGNED_INT_VEC4: return "uvec4";
+        case GL_BOOL: return "bool";
+        case GL_BOOL_VEC2: return "bvec2";
+        case GL_BOOL_VEC3: return "bvec3";
+        case GL_BOOL_VEC4: return "bvec4";
+        case GL_FLOAT_MAT2: return "mat2";
+        case GL_FLOAT_MAT3: return "mat3";
+        case GL_FLOAT_MAT4: return "mat4";
+        case GL_FLOAT_MAT2x3: return "mat2x3";
+        case GL_FLOAT_MAT2x4: return "mat2x4";
+        case GL_FLOAT_MAT3x2: return "mat3x2";
+        case GL_FLOAT_MAT3x4: return "mat3x4";
+        case GL_FLOAT_MAT4x2: return "mat4x2";
+        case GL_FLOAT_MAT4x3: return "mat4x3";
+        case GL_SAMPLER_2D: return "sampler2D";
+        case GL_SAMPLER_3D: return "sampler3D";
+        case GL_SAMPLER_CUBE: return "samplerCube";
+        case GL_SAMPLER_2D_SHADOW: return "sampler2DShadow";
+        case GL_SAMPLER_2D_ARRAY: return "sampler2DArray";
+        case GL_SAMPLER_2D_ARRAY_SHADOW: return "sampler2DArrayShadow";
+        case GL_SAMPLER_CUBE_SHADOW: return "samplerCubeShadow";
+        case GL_INT_SAMPLER_2D: return "isampler2D";
+        case GL_INT_SAMPLER_3D: return "isampler3D";
+        case GL_INT_SAMPLER_CUBE: return "isamplerCube";
+        case GL_INT_SAMPLER_2D_ARRAY: return "isampler2DArray";
+        case GL_UNSIGNED_INT_SAMPLER_2D: return "usampler2D";
+        case GL_UNSIGNED_INT_SAMPLER_3D: return "usampler3D";
+        case GL_UNSIGNED_INT_SAMPLER_CUBE: return "usamplerCube";
+        case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY: return "usampler2DArray";
+        case GL_SAMPLER_2D_MULTISAMPLE: return "sampler2DMS";
+        case GL_INT_SAMPLER_2D_MULTISAMPLE: return "isampler2DMS";
+        case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE: return "usampler2DMS";
+        case GL_SAMPLER_2D_MULTISAMPLE_ARRAY: return "sampler2DMSArray";
+        case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY: return "isampler2DMSArray";
+        case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY: return "usampler2DMSArray";
+        case GL_SAMPLER_BUFFER: return "samplerBuffer";
+        case GL_INT_SAMPLER_BUFFER: return "isamplerBuffer";
+        case GL_UNSIGNED_INT_SAMPLER_BUFFER: return "usamplerBuffer";
+        case GL_SAMPLER_CUBE_MAP_ARRAY: return "samplerCubeArray";
+        case GL_SAMPLER_CUBE_MAP_ARRAY_SHADOW: return "samplerCubeArrayShadow";
+        case GL_INT_SAMPLER_CUBE_MAP_ARRAY: return "isamplerCubeArray";
+        case GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY: return "usamplerCubeArray";
+        default:
+        {
+            char name[16];
+            std::snprintf(name, sizeof(name), "0x%04x", type);
+            return name;
+        }
+        }
+    }
+
+private:
+    static bool isSampler(GLenum type)
+    {
+        return typeName(type).find("sampler") != std::string::npos;
+    }
+
+    template <typename Entry>
+    static const Entry *byName(const std::vector<Entry> &entries, const std::string &name)
+    {
+        for (const Entry &entry : entries)
+            if (entry.name == name)
+                return &entry;
+        return nullptr;
+    }
+
+    static std::string quote(const std::string &text)
+    {
+        std::string out = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        return out + "\"";
+    }
+};
+#endif
@@ -0,0 +1,219 @@
+#ifndef SHADER_RELOADER_H
+#define SHADER_RELOADER_H
+
+#include "Shader.h"
+#include "ShaderCompiler.h"
+#include "ShaderSources.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// rebuilds shaders while the program runs when their files, or files they
+// include, change on disk. the directories holding the files are watched
+// with inotify, so saving from an editor that writes a new file and renames
+// it over the old one is seen too.
+//
+// update() is called once a frame, between frames. it starts rebuilding
+// shaders whose files changed through a ShaderCompiler and, once a rebuild
+// is ready, swaps it into the Shader the render code holds with
+// Shader::replace(), which keeps the old program if the new one didn't link.
+// update() only polls the rebuilds, so they compile on the driver's threads
+// or the compiler's worker; only a compiler with neither finishes them
+// during the update() after the change.
+class ShaderReloader
+{
+public:
+    struct Stats
+    {
+        int reloaded = 0;
+        int failed = 0;     // didn't compile or link; the old program stays
+    };
+
+    // rebuilds go through compiler, which has to outlive the reloader
+    explicit ShaderReloader(ShaderCompiler &compiler)
+        : compiler(compiler)
+    {
+        descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (descriptor < 0)
+            std::cout << "ERROR::SHADER_RELOADER::INOTIFY_FAILED" << std::endl;
+    }
+    ~ShaderReloader()
+    {
+        for (Entry &entry : entries)
+            discard(entry);
+        if (descriptor >= 0)
+            close(descriptor);
+    }
+    // the reloader owns a file descriptor, so it can't be copied
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    // reload shader from the files it was made from. the shader has to
+    // outlive the reloader, or at least its last update().
+    // ------------------------------------------------------------------------
+    void watch(Shader &shader, const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    {
+        std::vector<std::string> paths = { vertexPath, fragmentPath };
+        if (geometryPath)
+            paths.push_back(geometryPath);
+        std::string vertex = vertexPath, fragment = fragmentPath, geometry = geometryPath ? geometryPath : "";
+        watch(shader, paths, [vertex, fragment, geometry](ShaderCompiler &compiler)
+        {
+            return compiler.compile(vertex, fragment, geometry);
+        });
+    }
+    // reload shader with rebuild, which starts a new shader compiling on the
+    // compiler it's given, whenever a file read through ShaderSources for one
+    // of paths changes
+    // ------------------------------------------------------------------------
+    void watch(Shader &shader, const std::vector<std::string> &paths, std::function<ShaderFuture(ShaderCompiler &)> rebuild)
+    {
+        entries.emplace_back();
+        Entry &entry = entries.back();
+        entry.shader = &shader;
+        entry.paths = paths;
+        entry.rebuild = rebuild;
+        refresh(entry);
+    }
+
+    // once a frame, between frames
+    // ------------------------------------------------------------------------
+    void update()
+    {
+        std::unordered_set<std::string> changed = events();
+        for (Entry &entry : entries)
+        {
+            if (!changed.empty() && touches(entry, changed))
+            {
+                // a rebuild that started before this change is thrown away
+                // once it's done, and another started
+                if (entry.pending.valid())
+                    entry.stale = true;
+                else
+                    entry.pending = entry.rebuild(compiler);
+            }
+            if (!entry.pending.ready())
+                continue;
+
+            std::unique_ptr<Shader> fresh = entry.pending.take();
+            if (entry.stale)
+            {
+                entry.stale = false;
+                entry.pending = entry.rebuild(compiler);
+                continue;
+            }
+            if (entry.shader->replace(*fresh))
+                ++counters.reloaded;
+            else
+                ++counters.failed;
+            // the includes may have changed
+            refresh(entry);
+        }
+    }
+
+    const Stats &stats() const
+    {
+        return counters;
+    }
+
+private:
+    struct Entry
+    {
+        Shader *shader = nullptr;
+        std::vector<std::string> paths;
+        std::function<ShaderFuture(ShaderCompiler &)> rebuild;
+        std::vector<std::string> files;     // canonical paths of everything it reads
+        ShaderFuture pending;
+        bool stale = false;
+    };
+
+    ShaderCompiler &compiler;
+    int descriptor = -1;
+    // a deque, so entries stay put as more are watched
+    std::deque<Entry> entries;
+    std::unordered_map<int, std::string> directories;   // by watch descriptor
+    Stats counters;
+
+    // the absolute path of a file that may not exist: its directory resolved
+    // and its name as it is, which is also how inotify names it
+    static std::string canonical(const std::string &path)
+    {
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        char *real = realpath(directory.c_str(), nullptr);
+        std::string resolved = real ? std::string(real) : directory;
+        std::free(real);
+        return resolved + "/" + path.substr(slash + 1);
+    }
+
+    // find every file the entry's sources read and watch their directories
+    void refresh(Entry &entry)
+    {
+        entry.files.clear();
+        for (const std::string &path : entry.paths)
+            for (const std::string &file : ShaderSources::shared().dependencies(path))
+                entry.files.push_back(canonical(file));
+        if (descriptor < 0)
+            return;
+        for (const std::string &file : entry.files)
+        {
+            std::string directory = file.substr(0, file.rfind('/'));
+            int watch = inotify_add_watch(descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            if (watch < 0)
+                std::cout << "ERROR::SHADER_RELOADER::CANT_WATCH: " << directory << std::endl;
+            else
+                directories[watch] = directory;
+        }
+    }
+
+    // the files changed since the last update
+    std::unordered_set<std::string> events()
+    {
+        std::unordered_set<std::string> changed;
+        if (descriptor < 0)
+            return changed;
+        alignas(inotify_event) char buffer[4096];
+        for (;;)
+        {
+            ssize_t got = read(descriptor, buffer, sizeof(buffer));
+            if (got <= 0)
+                break;
+            for (ssize_t at = 0; at < got;)
+            {
+                const inotify_event *event = (const inotify_event *)(buffer + at);
+                auto directory = directories.find(event->wd);
+                if (event->len && directory != directories.end())
+                    changed.insert(directory->second + "/" + event->name);
+                at += sizeof(inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+
+    static bool touches(const Entry &entry, const std::unordered_set<std::string> &changed)
+    {
+        return std::any_of(entry.files.begin(), entry.files.end(),
+                           [&](const std::string &file) { return changed.count(file) != 0; });
+    }
+
+    // drop a rebuild that's no longer wanted, once it's done, so its shader
+    // objects are cleaned up with it
+    static void discard(Entry &entry)
+    {
+        if (entry.pending.valid())
+            entry.pending.take();
+        entry.stale = false;
+    }
+};
+#endif
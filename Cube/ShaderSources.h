@@ -0,0 +1,302 @@
+#ifndef SHADER_SOURCES_H
+#define SHADER_SOURCES_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// shader sources read from disk, with #include "file" resolved, so programs
+// can share common code. every file is read once, with a single read() into
+// a string of its size, and kept until its mtime or size changes; resolved
+// sources are kept too and handed out shared, so the hundredth program using
+// a header costs a stat per file rather than a read and a copy.
+//
+// includes are relative to the including file and each file goes in once
+// per source, as if every file had include guards, which also stops include
+// cycles. every file gets a source string number of its own, and #line
+// directives around every include keep the driver's line numbers pointing
+// into the right file; describe() turns the numbers in an info log back into
+// paths. a source with a #version line keeps it first.
+//
+// Shader and ShaderVariants read their files through shared(), which is safe
+// to use from ShaderCompiler's worker thread.
+class ShaderSources
+{
+public:
+    struct Stats
+    {
+        int reads = 0;      // files read from disk
+        int resolved = 0;   // sources put together from their files
+        int hits = 0;       // sources handed out as they were
+    };
+
+    static ShaderSources &shared()
+    {
+        static ShaderSources sources;
+        return sources;
+    }
+
+    // the source in path with its includes resolved; empty if it can't be read
+    // ------------------------------------------------------------------------
+    std::shared_ptr<const std::string> get(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = resolved.find(path);
+        if (found != resolved.end() && current(found->second.files))
+        {
+            ++counters.hits;
+            return found->second.text;
+        }
+        Resolved entry;
+        std::string text;
+        std::unordered_set<std::string> included;
+        append(path, text, entry.files, included, true);
+        entry.text = std::make_shared<const std::string>(std::move(text));
+        resolved[path] = entry;
+        ++counters.resolved;
+        return entry.text;
+    }
+
+    // source with defines, "#define NAME 1" lines, put after its #version
+    // line, which has to come first. the #line get() puts after it keeps the
+    // numbering as in the file.
+    // ------------------------------------------------------------------------
+    static std::string withDefines(const std::string &source, const std::string &defines)
+    {
+        size_t version = source.find("#version");
+        if (version == std::string::npos || (version > 0 && source[version - 1] != '\n'))
+            return defines + source;
+        size_t end = source.find('\n', version);
+        if (end == std::string::npos)
+            return source + "\n" + defines;
+        return source.substr(0, end + 1) + defines + source.substr(end + 1);
+    }
+
+    // the files path's source was put together from, itself first
+    // ------------------------------------------------------------------------
+    std::vector<std::string> dependencies(const std::string &path)
+    {
+        get(path);
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> paths;
+        for (const Dependency &dependency : resolved[path].files)
+            paths.push_back(dependency.path);
+        return paths;
+    }
+
+    // an info log with the source string numbers at the start of its
+    // messages, "3:12(5): error" or "3(12) : error", replaced by file paths
+    // ------------------------------------------------------------------------
+    std::string describe(const std::string &log) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string out;
+        size_t start = 0;
+        while (start < log.size())
+        {
+            size_t end = log.find('\n', start);
+            end = end == std::string::npos ? log.size() : end + 1;
+            std::string line = log.substr(start, end - start);
+            size_t digits = 0;
+            const char *prefixes[] = { "ERROR: ", "WARNING: " };
+            for (const char *prefix : prefixes)
+                if (line.compare(0, std::strlen(prefix), prefix) == 0)
+                    digits = std::strlen(prefix);
+            size_t after = digits;
+            while (after < line.size() && line[after] >= '0' && line[after] <= '9')
+                ++after;
+            if (after > digits && after < line.size() && (line[after] == ':' || line[after] == '('))
+            {
+                auto name = names.find(std::atoi(line.c_str() + digits));
+                if (name != names.end())
+                    line.replace(digits, after - digits, name->second);
+            }
+            out += line;
+            start = end;
+        }
+        return out;
+    }
+
+    const Stats &stats() const
+    {
+        return counters;
+    }
+
+private:
+    struct File
+    {
+        std::string text;
+        struct timespec mtime;
+        off_t size = -1;
+        int id = 0;
+    };
+    struct Dependency
+    {
+        std::string path;
+        struct timespec mtime;
+        off_t size;
+    };
+    struct Resolved
+    {
+        std::shared_ptr<const std::string> text;
+        std::vector<Dependency> files;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, File> files;
+    std::unordered_map<std::string, Resolved> resolved;
+    std::unordered_map<int, std::string> names;     // source string number to path
+    Stats counters;
+
+    // whether none of the files a source was put together from has changed
+    static bool current(const std::vector<Dependency> &dependencies)
+    {
+        for (const Dependency &dependency : dependencies)
+        {
+            struct stat info;
+            if (stat(dependency.path.c_str(), &info) != 0 || info.st_size != dependency.size ||
+                info.st_mtim.tv_sec != dependency.mtime.tv_sec || info.st_mtim.tv_nsec != dependency.mtime.tv_nsec)
+                return false;
+        }
+        return true;
+    }
+
+    // the file's contents, read again only if it changed; null if it can't be
+    const File *load(const std::string &path)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return nullptr;
+        File &file = files[path];
+        if (file.size == info.st_size && file.mtime.tv_sec == info.st_mtim.tv_sec && file.mtime.tv_nsec == info.st_mtim.tv_nsec)
+            return &file;
+
+        int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0)
+        {
+            files.erase(path);
+            return nullptr;
+        }
+        file.text.resize(info.st_size);
+        size_t done = 0;
+        while (done < file.text.size())
+        {
+            ssize_t got = read(descriptor, &file.text[done], file.text.size() - done);
+            if (got <= 0)
+                break;
+            done += got;
+        }
+        close(descriptor);
+        // a file that shrank while being read is taken as it was
+        file.text.resize(done);
+        file.mtime = info.st_mtim;
+        file.size = info.st_size;
+        if (!file.id)
+            file.id = number(path);
+        ++counters.reads;
+        return &file;
+    }
+
+    // a source string number for path that stays the same between runs, so
+    // resolved sources hash the same for ShaderVariants' program binaries
+    int number(const std::string &path)
+    {
+        uint32_t hash = 2166136261u;
+        for (char c : path)
+            hash = (hash ^ (unsigned char)c) * 16777619u;
+        int id = 1 + (int)(hash % 99999u);
+        while (names.count(id) && names[id] != path)
+            id = id % 99999 + 1;
+        names[id] = path;
+        return id;
+    }
+
+    static std::string lineDirective(size_t line, int id)
+    {
+        return "#line " + std::to_string(line) + " " + std::to_string(id) + "\n";
+    }
+
+    // append path to out with its includes resolved in place
+    void append(const std::string &path, std::string &out, std::vector<Dependency> &dependencies,
+                std::unordered_set<std::string> &included, bool root)
+    {
+        const File *file = load(path);
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+            // never current, so the source is put together again once it's there
+            dependencies.push_back({ path, {}, -1 });
+            return;
+        }
+        dependencies.push_back({ path, file->mtime, file->size });
+        char *canonical = realpath(path.c_str(), nullptr);
+        included.insert(canonical ? canonical : path);
+        std::free(canonical);
+        // copied, as including other files may read more into the map
+        const std::string text = file->text;
+        const int id = file->id;
+        const std::string directory = path.substr(0, path.rfind('/') + 1);
+
+        // the #version line has to stay first, so the numbering starts after it
+        size_t first = text.find_first_not_of(" \t\r\n");
+        bool versioned = root && first != std::string::npos && text.compare(first, 8, "#version") == 0;
+        if (!versioned)
+            out += lineDirective(1, id);
+
+        size_t start = 0;
+        for (size_t line = 1; start < text.size(); ++line)
+        {
+            size_t end = text.find('\n', start);
+            end = end == std::string::npos ? text.size() : end + 1;
+            size_t directive = text.find_first_not_of(" \t", start);
+            if (versioned && directive == first)
+            {
+                out.append(text, start, end - start);
+                if (text[end - 1] != '\n')
+                    out += '\n';
+                out += lineDirective(line + 1, id);
+            }
+            else if (directive < end && text.compare(directive, 8, "#include") == 0)
+            {
+                size_t open = text.find('"', directive);
+                size_t close = open < end ? text.find('"', open + 1) : std::string::npos;
+                if (close >= end)
+                {
+                    std::cout << "ERROR::SHADER::BAD_INCLUDE: " << path << ":" << line << std::endl;
+                    out += '\n';
+                }
+                else
+                {
+                    std::string child = directory + text.substr(open + 1, close - open - 1);
+                    char *real = realpath(child.c_str(), nullptr);
+                    bool seen = real && included.count(real);
+                    std::free(real);
+                    if (!seen)
+                    {
+                        append(child, out, dependencies, included, false);
+                        out += lineDirective(line + 1, id);
+                    }
+                    else
+                        out += '\n';
+                }
+            }
+            else
+                out.append(text, start, end - start);
+            start = end;
+        }
+        if (!out.empty() && out.back() != '\n')
+            out += '\n';
+    }
+};
+#endif
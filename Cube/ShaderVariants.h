@@ -0,0 +1,316 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include "Shader.h"
+#include "ShaderCompiler.h"
+#include "ShaderReloader.h"
+#include "ShaderSources.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <iostream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// one vertex/fragment source pair compiled into a program per combination of
+// features, instead of a copy of the files per feature or branches on
+// uniforms in the shader. every feature is a #define the shader can #ifdef
+// on; a variant is a bitmask with bit i set for features[i], and its program
+// gets "#define FEATURE 1" for each set bit added after the #version line.
+//
+// get() compiles a variant the first time it's asked for. prewarm() starts a
+// declared set compiling up front, so drivers that compile in the background
+// work on them side by side and get() only collects them. given a
+// ShaderCompiler, the variants are compiled through it, so drivers without
+// parallel compiling build them on its worker context instead of here.
+//
+// given a directory, linked programs are also kept there as program binaries
+// between runs, keyed by the sources, defines and driver, so a warm start
+// skips the compiler. a binary the driver refuses (after an update, say) is
+// deleted and the variant compiled from source.
+class ShaderVariants
+{
+public:
+    struct Stats
+    {
+        int compiled = 0;
+        int loaded = 0;     // from a program binary
+        int stored = 0;
+    };
+
+    ShaderVariants(const char* vertexPath, const char* fragmentPath, const std::vector<std::string> &features,
+                   const std::string &binaryDirectory = "")
+        : features(features), directory(binaryDirectory), vertexPath(vertexPath), fragmentPath(fragmentPath)
+    {
+        if (features.size() > 32)
+            std::cout << "ERROR::SHADER_VARIANTS::TOO_MANY_FEATURES: " << features.size() << std::endl;
+        if (!directory.empty())
+        {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+            formats.resize(count);
+            if (count)
+                glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+            if (formats.empty())
+                directory.clear();
+            else
+                mkdir(directory.c_str(), 0755);
+        }
+    }
+
+    // compile variants made from now on through compiler, which has to
+    // outlive them until they're collected with get()
+    // ------------------------------------------------------------------------
+    void setCompiler(ShaderCompiler *compiler)
+    {
+        this->compiler = compiler;
+    }
+
+    // the mask bit of a feature, or 0 if there's no such feature
+    // ------------------------------------------------------------------------
+    uint32_t bit(const std::string &feature) const
+    {
+        for (size_t i = 0; i < features.size() && i < 32; ++i)
+            if (features[i] == feature)
+                return 1u << i;
+        std::cout << "ERROR::SHADER_VARIANTS::UNKNOWN_FEATURE: " << feature << std::endl;
+        return 0;
+    }
+    // start compiling variants that will be needed, without waiting for them
+    // ------------------------------------------------------------------------
+    void prewarm(const std::vector<uint32_t> &masks)
+    {
+        for (uint32_t mask : masks)
+            variant(mask);
+    }
+    // the variant's program, compiled or loaded the first time it's asked for
+    // ------------------------------------------------------------------------
+    Shader &get(uint32_t mask)
+    {
+        Variant &found = variant(mask);
+        if (found.pending)
+        {
+            found.pending = false;
+            if (found.future.valid())
+                found.shader = found.future.take();
+            else
+                found.shader->finish();
+            store(found);
+        }
+        return *found.shader;
+    }
+    // have reloader rebuild the variants made so far when the sources
+    // change. call it once they've all been collected with get().
+    // ------------------------------------------------------------------------
+    void watch(ShaderReloader &reloader)
+    {
+        for (auto &entry : variants)
+        {
+            uint32_t mask = entry.first;
+            reloader.watch(*entry.second.shader, { vertexPath, fragmentPath }, [this, mask](ShaderCompiler &compiler)
+            {
+                std::string vertex, fragment;
+                sources(mask, vertex, fragment);
+                return compiler.compileSource(vertex, fragment);
+            });
+        }
+    }
+    // how many variants exist, compiled or still compiling
+    size_t size() const
+    {
+        return variants.size();
+    }
+    const Stats &stats() const
+    {
+        return counters;
+    }
+
+private:
+    struct Variant
+    {
+        std::unique_ptr<Shader> shader;
+        ShaderFuture future;    // the shader while compiler builds it
+        uint64_t key = 0;
+        bool pending = false;   // compiling from source; finished by get()
+    };
+
+    std::vector<std::string> features;
+    std::string directory;
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::vector<GLint> formats;
+    std::unordered_map<uint32_t, Variant> variants;
+    ShaderCompiler *compiler = nullptr;
+    Stats counters;
+
+    Variant &variant(uint32_t mask)
+    {
+        auto found = variants.find(mask);
+        if (found != variants.end())
+            return found->second;
+
+        Variant &created = variants[mask];
+        std::string vertex, fragment;
+        sources(mask, vertex, fragment);
+        if (!directory.empty())
+        {
+            created.key = key(vertex, fragment);
+            GLuint program = load(created.key);
+            if (program)
+            {
+                created.shader.reset(new Shader(Shader::Linked(), program));
+                ++counters.loaded;
+                return created;
+            }
+        }
+        if (compiler)
+            created.future = compiler->compileSource(vertex, fragment, "", !directory.empty());
+        else
+            created.shader.reset(new Shader(Shader::Source(), vertex, fragment, "", !directory.empty()));
+        created.pending = true;
+        ++counters.compiled;
+        return created;
+    }
+
+    // the variant's sources as they are on disk now
+    void sources(uint32_t mask, std::string &vertex, std::string &fragment) const
+    {
+        std::string defines;
+        for (size_t i = 0; i < features.size() && i < 32; ++i)
+            if (mask & (1u << i))
+                defines += "#define " + features[i] + " 1\n";
+        vertex = ShaderSources::withDefines(*ShaderSources::shared().get(vertexPath), defines);
+        fragment = ShaderSources::withDefines(*ShaderSources::shared().get(fragmentPath), defines);
+    }
+
+    struct Header
+    {
+        char magic[4];
+        uint32_t format = 0;
+        uint64_t key = 0;
+        uint64_t bytes = 0;
+    };
+    static const char *magic()
+    {
+        return "SHB1";
+    }
+    // far beyond any real program binary
+    static const uint64_t maxBinaryBytes = 64u << 20;
+
+    std::string binaryPath(uint64_t key) const
+    {
+        char name[24];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+        return directory + "/" + name;
+    }
+
+    // a binary only works with the driver that made it, so that's hashed too
+    static uint64_t key(const std::string &vertex, const std::string &fragment)
+    {
+        uint64_t hash = hashBytes(vertex.data(), vertex.size());
+        hash = hashBytes(fragment.data(), fragment.size(), hash);
+        const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (GLenum name : strings)
+        {
+            const char *value = (const char *)glGetString(name);
+            if (value)
+                hash = hashBytes(value, std::strlen(value), hash);
+        }
+        return hash ? hash : 1;
+    }
+
+    GLuint load(uint64_t key)
+    {
+        std::string path = binaryPath(key);
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return 0;
+        Header header;
+        std::vector<char> binary;
+        // the size is only as good as the file, so it has to be what's left
+        // of it and within reason before anything is allocated for it
+        struct stat info;
+        bool ok = stat(path.c_str(), &info) == 0 && (uint64_t)info.st_size >= sizeof(header) &&
+                  (bool)file.read((char *)&header, sizeof(header)) &&
+                  std::memcmp(header.magic, magic(), sizeof(header.magic)) == 0 && header.key == key &&
+                  std::find(formats.begin(), formats.end(), (GLint)header.format) != formats.end() &&
+                  header.bytes == (uint64_t)info.st_size - sizeof(header) && header.bytes <= maxBinaryBytes;
+        if (ok)
+        {
+            binary.resize(header.bytes);
+            ok = (bool)file.read(binary.data(), binary.size());
+        }
+        GLuint program = 0;
+        if (ok)
+        {
+            program = glCreateProgram();
+            glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+            GLint linked = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            if (!linked)
+            {
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+        if (!program)
+        {
+            // stale or from another driver; it gets rewritten once compiled
+            std::cout << "ERROR::SHADER_VARIANTS::BAD_BINARY: " << path << std::endl;
+            unlink(path.c_str());
+        }
+        return program;
+    }
+
+    // written to a temporary file and renamed into place, like TextureCache
+    void store(const Variant &variant)
+    {
+        if (directory.empty() || !variant.key)
+            return;
+        GLint linked = GL_FALSE, length = 0;
+        glGetProgramiv(variant.shader->ID, GL_LINK_STATUS, &linked);
+        glGetProgramiv(variant.shader->ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!linked || length <= 0)
+            return;
+        std::vector<char> binary(length);
+        Header header;
+        std::memcpy(header.magic, magic(), sizeof(header.magic));
+        GLenum format = 0;
+        glGetProgramBinary(variant.shader->ID, length, &length, &format, binary.data());
+        header.format = format;
+        header.key = variant.key;
+        header.bytes = (uint64_t)length;
+
+        std::string path = binaryPath(variant.key);
+        std::string temporary = path + ".tmp" + std::to_string(getpid());
+        FILE *out = std::fopen(temporary.c_str(), "wb");
+        bool ok = out && std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+                  std::fwrite(binary.data(), 1, (size_t)length, out) == (size_t)length;
+        if (out)
+            ok = std::fclose(out) == 0 && ok;
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "ERROR::SHADER_VARIANTS::FAILED_TO_WRITE: " << path << std::endl;
+            unlink(temporary.c_str());
+            return;
+        }
+        ++counters.stored;
+    }
+
+    // 64-bit FNV-1a
+    static uint64_t hashBytes(const char *bytes, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ull;
+        return hash;
+    }
+};
+#endif
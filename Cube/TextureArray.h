@@ -0,0 +1,426 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include "stb_image.h"
+#include "GLHandle.h"
+#include "MipChain.h"
+#include "Etc2Encoder.h"
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// how an image may be changed to share an array with images of another size
+enum class ArrayFit
+{
+    Exact,  // only goes into layers of its own size
+    Pad,    // may sit in the corner of a larger layer, with its edges repeated
+            // around it. texcoords have to stay in 0..1 and be scaled.
+    Resize  // may be resampled to any layer size, and keeps wrapping
+};
+
+// where a packed image ended up
+struct ArrayLayer
+{
+    int array = -1;         // index of the TextureArray, -1 if the image failed to load
+    int layer = 0;
+    float scaleS = 1.0f;    // texcoord scale that keeps a padded image's
+    float scaleT = 1.0f;    // samples inside the image
+};
+
+// a GL_TEXTURE_2D_ARRAY owned by a TextureArrayPacker
+struct TextureArray
+{
+    GLTexture ID;
+    int width = 0;
+    int height = 0;
+    int layers = 0;
+    int levels = 0;
+    int channels = 0;
+    GLenum internalFormat = 0;
+};
+
+// packs images of the same format into the layers of texture arrays, so
+// materials that differ only in their textures are drawn with a single bind:
+// the shader gets a sampler2DArray and picks the layer from a uniform or
+// attribute. images are queued with add() and uploaded by build().
+class TextureArrayPacker
+{
+public:
+    TextureArrayPacker() {}
+
+    // compress RGB and RGBA arrays built from now on to ETC2, as
+    // TextureManager::setCompression does for single textures
+    // ------------------------------------------------------------------------
+    void setCompression(bool enabled, Etc2Encoder::Quality quality = Etc2Encoder::Fast)
+    {
+        compress = enabled;
+        encoder = Etc2Encoder(quality);
+        this->quality = quality;
+    }
+    const Etc2Encoder::Stats &compressionStats() const
+    {
+        return encoder.stats();
+    }
+
+    // keep finished layers in a cache, as TextureManager::setCache does for
+    // textures. with a cache, add() only reads the image's header, and
+    // build() decodes the image if the cache doesn't have its layer.
+    // ------------------------------------------------------------------------
+    void setCache(TextureCache *cache)
+    {
+        this->cache = cache;
+    }
+
+    // queue an image file; returns the handle to look its layer up with once
+    // build() has run. srgb is as in TextureManager::load.
+    // ------------------------------------------------------------------------
+    int add(const std::string &path, ArrayFit fit = ArrayFit::Exact, bool srgb = true)
+    {
+        int width, height, channels;
+        if (cache)
+        {
+            placed.push_back(ArrayLayer());
+            int handle = (int)placed.size() - 1;
+            if (!stbi_info(path.c_str(), &width, &height, &channels))
+            {
+                std::cout << "ERROR::TEXTURE_ARRAY::FAILED_TO_LOAD: " << path << " (" << stbi_failure_reason() << ")" << std::endl;
+                return handle;
+            }
+            Image image;
+            image.handle = handle;
+            image.width = width;
+            image.height = height;
+            image.channels = channels;
+            image.fit = fit;
+            image.srgb = srgb;
+            image.path = path;
+            pending.push_back(std::move(image));
+            return handle;
+        }
+        unsigned char *data = stbi_load(path.c_str(), &width, &height, &channels, 0);
+        if (!data)
+        {
+            std::cout << "ERROR::TEXTURE_ARRAY::FAILED_TO_LOAD: " << path << " (" << stbi_failure_reason() << ")" << std::endl;
+            placed.push_back(ArrayLayer());
+            return (int)placed.size() - 1;
+        }
+        int handle = add(data, width, height, channels, fit, srgb);
+        stbi_image_free(data);
+        return handle;
+    }
+    // queue already decoded 8-bit pixels with 1 to 4 channels, tightly packed
+    // ------------------------------------------------------------------------
+    int add(const unsigned char *pixels, int width, int height, int channels, ArrayFit fit = ArrayFit::Exact, bool srgb = true)
+    {
+        placed.push_back(ArrayLayer());
+        int handle = (int)placed.size() - 1;
+        if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4)
+        {
+            std::cout << "ERROR::TEXTURE_ARRAY::INVALID_IMAGE" << std::endl;
+            return handle;
+        }
+        Image image;
+        image.handle = handle;
+        image.width = width;
+        image.height = height;
+        image.channels = channels;
+        image.fit = fit;
+        image.srgb = srgb;
+        image.pixels.assign(pixels, pixels + (size_t)width * height * channels);
+        pending.push_back(std::move(image));
+        return handle;
+    }
+
+    // group the queued images into arrays and upload them. images share an
+    // array if they have the same srgb flag and channel count, except that RGB
+    // images join RGBA arrays with an opaque alpha, and if their fits allow
+    // their sizes to meet without costing too much: a resized image's area may
+    // change by at most maxResizeArea times, and a padded image may fill no
+    // less than 1 / maxPadArea of its layer. past that it starts an array of
+    // its own size.
+    // ------------------------------------------------------------------------
+    void build()
+    {
+        GLint maxLayers;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+        // exact images first so they fix the layer sizes, then largest first
+        // so padded images find layers big enough
+        std::stable_sort(pending.begin(), pending.end(), [](const Image &a, const Image &b)
+        {
+            if ((a.fit == ArrayFit::Exact) != (b.fit == ArrayFit::Exact))
+                return a.fit == ArrayFit::Exact;
+            return (size_t)a.width * a.height > (size_t)b.width * b.height;
+        });
+
+        std::vector<Bucket> buckets;
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            const Image &image = pending[i];
+            Bucket *target = nullptr;
+            double bestCost = 0.0;
+            for (Bucket &bucket : buckets)
+            {
+                if (bucket.srgb != image.srgb || colorClass(bucket.channels) != colorClass(image.channels) ||
+                    (int)bucket.members.size() >= maxLayers)
+                    continue;
+                double cost;
+                if (bucket.width == image.width && bucket.height == image.height)
+                    cost = 0.0;
+                else if (image.fit == ArrayFit::Pad && bucket.width >= image.width && bucket.height >= image.height)
+                    cost = (double)bucket.width * bucket.height / ((double)image.width * image.height);
+                else if (image.fit == ArrayFit::Resize)
+                    cost = std::fabs(std::log((double)bucket.width * bucket.height / ((double)image.width * image.height)));
+                else
+                    continue;
+                if ((image.fit == ArrayFit::Pad && cost > maxPadArea) || (image.fit == ArrayFit::Resize && cost > std::log(maxResizeArea)))
+                    continue;
+                if (!target || cost < bestCost)
+                {
+                    target = &bucket;
+                    bestCost = cost;
+                }
+            }
+            if (!target)
+            {
+                buckets.push_back(Bucket());
+                target = &buckets.back();
+                target->width = image.width;
+                target->height = image.height;
+                target->channels = image.channels;
+                target->srgb = image.srgb;
+            }
+            target->channels = std::max(target->channels, image.channels);
+            target->members.push_back(i);
+        }
+
+        for (const Bucket &bucket : buckets)
+            upload(bucket);
+        pending.clear();
+    }
+
+    const ArrayLayer &layer(int handle) const
+    {
+        return placed[handle];
+    }
+    const TextureArray &array(int index) const
+    {
+        return arrays[index];
+    }
+    int arrayCount() const
+    {
+        return (int)arrays.size();
+    }
+    // bind an array and sampler to a texture unit
+    // ------------------------------------------------------------------------
+    void bind(unsigned int unit, int index, unsigned int samplerID) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[index].ID);
+        glBindSampler(unit, samplerID);
+    }
+
+private:
+    struct Image
+    {
+        int handle;
+        int width;
+        int height;
+        int channels;
+        ArrayFit fit;
+        bool srgb;
+        std::vector<unsigned char> pixels;  // empty until needed if there's a path
+        std::string path;
+    };
+    struct Bucket
+    {
+        int width;
+        int height;
+        int channels;
+        bool srgb;
+        std::vector<size_t> members;
+    };
+
+    // how far build() lets an image's fit stretch to share an array
+    static constexpr double maxResizeArea = 2.0;
+    static constexpr double maxPadArea = 4.0;
+
+    std::vector<Image> pending;
+    std::vector<ArrayLayer> placed;
+    std::vector<TextureArray> arrays;
+    bool compress = false;
+    Etc2Encoder::Quality quality = Etc2Encoder::Fast;
+    Etc2Encoder encoder;
+    TextureCache *cache = nullptr;
+
+    // RGB and RGBA images can share an array; 1 and 2 channel images only
+    // share with their own kind
+    static int colorClass(int channels)
+    {
+        return channels >= 3 ? 3 : channels;
+    }
+
+    void upload(const Bucket &bucket)
+    {
+        static const GLenum internalFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+        TextureArray array;
+        array.width = bucket.width;
+        array.height = bucket.height;
+        array.layers = (int)bucket.members.size();
+        array.channels = bucket.channels;
+        bool etc2 = compress && array.channels >= 3;
+        array.internalFormat = etc2 ? Etc2Encoder::format(array.channels) : internalFormats[array.channels - 1];
+
+        array.ID = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.ID);
+        GLint previousAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        for (int layer = 0; layer < array.layers; ++layer)
+        {
+            const Image &image = pending[bucket.members[layer]];
+            // the layer is cached as it ends up in the array: fitted, filtered
+            // and compressed
+            MipChain chain;
+            std::vector<unsigned char> blocks;
+            uint64_t variant = TextureCache::variant({ (uint64_t)array.width, (uint64_t)array.height, (uint64_t)array.channels,
+                                                       (uint64_t)image.fit, (uint64_t)(etc2 ? quality : 0), (uint64_t)etc2,
+                                                       (uint64_t)image.srgb });
+            uint64_t key = cache && !image.path.empty() ? cache->key(image.path, variant) : 0;
+            bool cached = key && cache->find(key, chain, blocks) && (int)chain.levels.size() > 0 &&
+                          chain.levels[0].width == array.width && chain.levels[0].height == array.height && chain.channels == array.channels;
+            if (!cached)
+            {
+                Image loaded;
+                if (image.pixels.empty())
+                    loaded = decode(image);
+                std::vector<unsigned char> pixels = fit(image.pixels.empty() ? loaded : image, array.width, array.height, array.channels);
+                chain = MipChain(pixels.data(), array.width, array.height, array.channels, image.srgb);
+                blocks.clear();
+            }
+            if (layer == 0)
+            {
+                array.levels = (int)chain.levels.size();
+                glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levels, array.internalFormat, array.width, array.height, array.layers);
+            }
+            size_t offset = 0;
+            for (int level = 0; level < array.levels; ++level)
+            {
+                const MipChain::Level &mip = chain.levels[level];
+                if (etc2)
+                {
+                    size_t size = Etc2Encoder::compressedSize(mip.width, mip.height, array.channels);
+                    if (!cached || blocks.size() < offset + size)
+                    {
+                        std::vector<unsigned char> encoded = encoder.encode(chain.pixels(level), mip.width, mip.height, array.channels);
+                        blocks.resize(offset);
+                        blocks.insert(blocks.end(), encoded.begin(), encoded.end());
+                        cached = false;
+                    }
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, mip.width, mip.height, 1, array.internalFormat, (GLsizei)size, blocks.data() + offset);
+                    offset += size;
+                }
+                else
+                {
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, (mip.width * array.channels) % 4 == 0 ? 4 : 1);
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, mip.width, mip.height, 1, formats[array.channels - 1], GL_UNSIGNED_BYTE, chain.pixels(level));
+                }
+            }
+
+            if (key && !cached)
+                cache->store(key, chain, blocks);
+
+            ArrayLayer &slot = placed[image.handle];
+            slot.array = (int)arrays.size();
+            slot.layer = layer;
+            bool padded = image.fit == ArrayFit::Pad;
+            slot.scaleS = padded ? (float)image.width / array.width : 1.0f;
+            slot.scaleT = padded ? (float)image.height / array.height : 1.0f;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        arrays.push_back(std::move(array));
+    }
+
+    // the pixels of an image add() only read the header of. a file that
+    // stopped decoding since gives a black layer.
+    static Image decode(const Image &image)
+    {
+        Image out = image;
+        int width, height, channels;
+        unsigned char *data = stbi_load(image.path.c_str(), &width, &height, &channels, image.channels);
+        if (data && width == image.width && height == image.height)
+            out.pixels.assign(data, data + (size_t)width * height * image.channels);
+        else
+        {
+            std::cout << "ERROR::TEXTURE_ARRAY::FAILED_TO_LOAD: " << image.path << std::endl;
+            out.pixels.assign((size_t)image.width * image.height * image.channels, 0);
+        }
+        stbi_image_free(data);
+        return out;
+    }
+    // the image's pixels at the layer's size and channel count
+    static std::vector<unsigned char> fit(const Image &image, int width, int height, int channels)
+    {
+        const Image *source = &image;
+        // shrinking by more than half starts from the mip level closest in
+        // size, so the gamma-correct box filter does most of the work
+        Image reduced;
+        if (image.fit == ArrayFit::Resize && (image.width >= 2 * width || image.height >= 2 * height))
+        {
+            MipChain chain(image.pixels.data(), image.width, image.height, image.channels, image.srgb);
+            size_t level = 0;
+            while (level + 1 < chain.levels.size() && chain.levels[level + 1].width >= width && chain.levels[level + 1].height >= height)
+                ++level;
+            reduced.channels = image.channels;
+            reduced.width = chain.levels[level].width;
+            reduced.height = chain.levels[level].height;
+            reduced.pixels.assign(chain.pixels((int)level), chain.pixels((int)level) + (size_t)reduced.width * reduced.height * image.channels);
+            source = &reduced;
+        }
+
+        std::vector<unsigned char> out((size_t)width * height * channels);
+        bool resample = image.fit == ArrayFit::Resize && (source->width != width || source->height != height);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+            {
+                unsigned char *texel = &out[((size_t)y * width + x) * channels];
+                if (resample)
+                    sampleBilinear(*source, (x + 0.5f) * source->width / width - 0.5f, (y + 0.5f) * source->height / height - 0.5f, texel);
+                else
+                {
+                    // padding repeats the last column and row
+                    const unsigned char *in = &source->pixels[((size_t)std::min(y, source->height - 1) * source->width + std::min(x, source->width - 1)) * source->channels];
+                    std::copy(in, in + source->channels, texel);
+                }
+                if (channels > source->channels)
+                    texel[3] = 255;
+            }
+        return out;
+    }
+    // the last step is a plain bilinear blend of the stored values, which
+    // stays within a factor of two of the source
+    static void sampleBilinear(const Image &image, float x, float y, unsigned char *out)
+    {
+        x = std::max(0.0f, std::min(x, image.width - 1.0f));
+        y = std::max(0.0f, std::min(y, image.height - 1.0f));
+        int x0 = (int)x, y0 = (int)y;
+        int x1 = std::min(x0 + 1, image.width - 1), y1 = std::min(y0 + 1, image.height - 1);
+        float fx = x - x0, fy = y - y0;
+        const unsigned char *a = &image.pixels[((size_t)y0 * image.width + x0) * image.channels];
+        const unsigned char *b = &image.pixels[((size_t)y0 * image.width + x1) * image.channels];
+        const unsigned char *c = &image.pixels[((size_t)y1 * image.width + x0) * image.channels];
+        const unsigned char *d = &image.pixels[((size_t)y1 * image.width + x1) * image.channels];
+        for (int k = 0; k < image.channels; ++k)
+        {
+            float top = a[k] + (b[k] - a[k]) * fx;
+            float bottom = c[k] + (d[k] - c[k]) * fx;
+            out[k] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+        }
+    }
+};
+#endif
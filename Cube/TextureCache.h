@@ -0,0 +1,347 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "stb_image.h"
+#include "MipChain.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// decoded images kept on disk between runs, so a warm start skips decoding,
+// mip filtering and compression. every entry is one file in the cache
+// directory holding a small header, the mip chain's pixels and, if the
+// texture is compressed, its blocks, laid out to be read straight into the
+// chain's buffers and uploaded.
+//
+// entries are found by key(): a hash of the source's path, size, mtime and
+// bytes, stb_image's vertical flip, and a variant the caller makes up from
+// whatever else changes the result (srgb, fit, compression). a changed file
+// simply gets a new key; the stale entry ages out. the directory is kept
+// under its capacity by deleting the least recently used entries, using the
+// files' mtimes, which find() refreshes, as the use time. temporary files
+// left by a writer that died are deleted along the way.
+// nothing in here touches GL, so loader threads can use it too.
+class TextureCache
+{
+public:
+    struct Stats
+    {
+        int hits = 0;
+        int misses = 0;
+        int stored = 0;
+        int pruned = 0;
+    };
+
+    explicit TextureCache(const std::string &directory = "texture_cache", size_t capacity = 256u << 20)
+        : directory(directory), capacity(capacity)
+    {
+        mkdir(directory.c_str(), 0755);
+    }
+
+    // the key for decoding path with the given variant; 0 if the file can't
+    // be read, which nothing is ever stored under
+    // ------------------------------------------------------------------------
+    uint64_t key(const std::string &path, uint64_t variant) const
+    {
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return 0;
+        struct stat info;
+        uint64_t content = 0;
+        bool ok = fstat(file, &info) == 0;
+        if (ok && info.st_size > 0)
+        {
+            void *bytes = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            ok = bytes != MAP_FAILED;
+            if (ok)
+            {
+                content = hashBytes((const unsigned char *)bytes, info.st_size);
+                munmap(bytes, info.st_size);
+            }
+        }
+        close(file);
+        if (!ok)
+            return 0;
+
+        const uint64_t fields[] = { (uint64_t)info.st_size, (uint64_t)info.st_mtim.tv_sec, (uint64_t)info.st_mtim.tv_nsec,
+                                    content, (uint64_t)stbi_get_flip_vertically_on_load(), variant };
+        uint64_t hash = hashBytes((const unsigned char *)path.data(), path.size());
+        hash = hashBytes((const unsigned char *)fields, sizeof(fields), hash);
+        return hash ? hash : 1;
+    }
+
+    // a variant made of several fields, hashed together so that no field
+    // can spill into another however large it gets
+    // ------------------------------------------------------------------------
+    static uint64_t variant(std::initializer_list<uint64_t> fields)
+    {
+        return hashBytes((const unsigned char *)fields.begin(), fields.size() * sizeof(uint64_t));
+    }
+
+    // the chain and compressed blocks stored under key, if there are any.
+    // blocks comes back empty for uncompressed entries.
+    // ------------------------------------------------------------------------
+    bool find(uint64_t key, MipChain &chain, std::vector<unsigned char> &blocks)
+    {
+        if (!key)
+            return false;
+        std::string path = entryPath(key);
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            ++counters.misses;
+            return false;
+        }
+        struct stat info;
+        bool ok = fstat(file, &info) == 0 && read(file, info.st_size, key, chain, blocks);
+        close(file);
+        if (!ok)
+        {
+            // truncated or from another version; it gets rewritten on store
+            std::cout << "ERROR::TEXTURE_CACHE::BAD_ENTRY: " << path << std::endl;
+            unlink(path.c_str());
+            ++counters.misses;
+            return false;
+        }
+        // mark it used for pruning
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        ++counters.hits;
+        return true;
+    }
+
+    // store a chain, and its blocks if it's compressed, under key, then prune
+    // the directory back under capacity. the entry is written to a temporary
+    // file and renamed into place, so other processes never see half of it.
+    // ------------------------------------------------------------------------
+    void store(uint64_t key, const MipChain &chain, const std::vector<unsigned char> &blocks)
+    {
+        if (!key || chain.levels.empty())
+            return;
+        Header header;
+        std::memcpy(header.magic, magic(), sizeof(header.magic));
+        header.key = key;
+        header.channels = chain.channels;
+        header.srgb = chain.srgb;
+        header.levels = (uint32_t)chain.levels.size();
+        header.pixelBytes = chain.data.size();
+        header.blockBytes = blocks.size();
+        std::vector<uint32_t> sizes;
+        for (const MipChain::Level &level : chain.levels)
+        {
+            sizes.push_back(level.width);
+            sizes.push_back(level.height);
+        }
+
+        std::string path = entryPath(key);
+        std::string temporary = path + ".tmp" + std::to_string(getpid());
+        FILE *out = std::fopen(temporary.c_str(), "wb");
+        if (!out)
+        {
+            std::cout << "ERROR::TEXTURE_CACHE::FAILED_TO_WRITE: " << temporary << std::endl;
+            return;
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+                  std::fwrite(sizes.data(), sizeof(uint32_t), sizes.size(), out) == sizes.size() &&
+                  std::fwrite(chain.data.data(), 1, chain.data.size(), out) == chain.data.size() &&
+                  std::fwrite(blocks.data(), 1, blocks.size(), out) == blocks.size();
+        ok = std::fclose(out) == 0 && ok;
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "ERROR::TEXTURE_CACHE::FAILED_TO_WRITE: " << path << std::endl;
+            unlink(temporary.c_str());
+            return;
+        }
+        ++counters.stored;
+        prune();
+    }
+
+    const Stats &stats() const
+    {
+        return counters;
+    }
+
+private:
+    // the file is native endian: it never leaves the machine that wrote it,
+    // and the magic tells a foreign one apart
+    struct Header
+    {
+        char magic[4];
+        uint32_t version = 1;
+        uint64_t key = 0;
+        uint32_t channels = 0;
+        uint32_t srgb = 0;
+        uint32_t levels = 0;
+        uint32_t reserved = 0;
+        uint64_t pixelBytes = 0;
+        uint64_t blockBytes = 0;
+    };
+    static const char *magic()
+    {
+        return "TXC1";
+    }
+
+    std::string directory;
+    size_t capacity;
+    Stats counters;
+
+    std::string entryPath(uint64_t key) const
+    {
+        char name[24];
+        std::snprintf(name, sizeof(name), "%016llx.tex", (unsigned long long)key);
+        return directory + "/" + name;
+    }
+
+    // read an entry straight into the chain's and blocks' buffers, checking
+    // it against its own header and the file's size on the way
+    static bool read(int file, size_t size, uint64_t key, MipChain &chain, std::vector<unsigned char> &blocks)
+    {
+        Header header;
+        if (size < sizeof(header) || !readAt(file, &header, sizeof(header), 0))
+            return false;
+        if (std::memcmp(header.magic, magic(), sizeof(header.magic)) != 0 || header.version != Header().version ||
+            header.key != key || header.channels < 1 || header.channels > 4 || header.levels < 1 || header.levels > 32)
+            return false;
+        size_t tableBytes = header.levels * 2 * sizeof(uint32_t);
+        if (header.pixelBytes > size || header.blockBytes > size ||
+            size != sizeof(header) + tableBytes + header.pixelBytes + header.blockBytes)
+            return false;
+
+        std::vector<uint32_t> table(header.levels * 2);
+        if (!readAt(file, table.data(), tableBytes, sizeof(header)))
+            return false;
+        chain = MipChain();
+        chain.channels = header.channels;
+        chain.srgb = header.srgb != 0;
+        size_t total = 0;
+        for (uint32_t level = 0; level < header.levels; ++level)
+        {
+            chain.levels.push_back({ (int)table[level * 2], (int)table[level * 2 + 1], total });
+            total += (size_t)table[level * 2] * table[level * 2 + 1] * header.channels;
+        }
+        if (total != header.pixelBytes)
+            return false;
+        chain.data.resize(header.pixelBytes);
+        blocks.resize(header.blockBytes);
+        return readAt(file, chain.data.data(), chain.data.size(), sizeof(header) + tableBytes) &&
+               readAt(file, blocks.data(), blocks.size(), sizeof(header) + tableBytes + header.pixelBytes);
+    }
+    static bool readAt(int file, void *out, size_t size, size_t offset)
+    {
+        unsigned char *bytes = (unsigned char *)out;
+        while (size)
+        {
+            ssize_t got = pread(file, bytes, size, offset);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+            bytes += got;
+            offset += got;
+            size -= got;
+        }
+        return true;
+    }
+
+    // a temporary file from store() whose writer has exited without renaming
+    // it; the pid can be reused, so an old enough one counts as abandoned too
+    static bool abandoned(const std::string &name, const struct stat &info)
+    {
+        size_t mark = name.rfind(".tmp");
+        if (mark == std::string::npos || mark + 4 == name.size() ||
+            name.find_first_not_of("0123456789", mark + 4) != std::string::npos)
+            return false;
+        pid_t writer = (pid_t)std::atol(name.c_str() + mark + 4);
+        if (writer == getpid())
+            return false;
+        return (kill(writer, 0) != 0 && errno == ESRCH) || time(nullptr) - info.st_mtim.tv_sec > 60 * 60;
+    }
+
+    // delete the least recently used entries until the rest fit
+    void prune()
+    {
+        struct File
+        {
+            std::string path;
+            size_t bytes;
+            struct timespec used;
+        };
+        std::vector<File> files;
+        size_t total = 0;
+        DIR *dir = opendir(directory.c_str());
+        if (!dir)
+            return;
+        while (struct dirent *item = readdir(dir))
+        {
+            std::string name = item->d_name;
+            File file;
+            file.path = directory + "/" + name;
+            struct stat info;
+            if (name.find(".tex") == std::string::npos || stat(file.path.c_str(), &info) != 0)
+                continue;
+            if (abandoned(name, info))
+            {
+                if (unlink(file.path.c_str()) == 0)
+                    ++counters.pruned;
+                continue;
+            }
+            if (name.compare(name.size() - 4, 4, ".tex") != 0)
+                continue;
+            file.bytes = info.st_size;
+            file.used = info.st_mtim;
+            total += file.bytes;
+            files.push_back(file);
+        }
+        closedir(dir);
+        if (total <= capacity)
+            return;
+
+        std::sort(files.begin(), files.end(), [](const File &a, const File &b)
+        {
+            return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+        });
+        for (const File &file : files)
+        {
+            if (total <= capacity)
+                break;
+            if (unlink(file.path.c_str()) == 0)
+            {
+                total -= file.bytes;
+                ++counters.pruned;
+            }
+        }
+    }
+
+    // FNV-1a style, but a word at a time so hashing the source file costs
+    // next to nothing next to decoding it
+    static uint64_t hashBytes(const unsigned char *bytes, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            hash = (hash ^ word) * 1099511628211ull;
+            hash ^= hash >> 32;
+        }
+        for (; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        return hash;
+    }
+};
+#endif
@@ -0,0 +1,557 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include "stb_image.h"
+#include "GLHandle.h"
+#include "MipChain.h"
+#include "Etc2Encoder.h"
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <iostream>
+
+// a texture owned by the TextureManager; ID is 0 if creation failed. the
+// manager may evict a texture and load it again later under another GL name,
+// so draw with TextureManager::bind, which looks it up by handle.
+struct Texture
+{
+    unsigned int ID = 0;
+    unsigned int handle = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int levels = 0;
+    GLenum internalFormat = 0;
+};
+
+// how a texture is sampled. textures don't carry this state themselves;
+// bind() pairs them with a shared sampler object instead.
+struct SamplerState
+{
+    GLenum wrapS = GL_REPEAT;
+    GLenum wrapT = GL_REPEAT;
+    GLenum minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    GLenum magFilter = GL_LINEAR;
+
+    bool operator==(const SamplerState &other) const
+    {
+        return wrapS == other.wrapS && wrapT == other.wrapT &&
+               minFilter == other.minFilter && magFilter == other.magFilter;
+    }
+};
+
+class TextureManager
+{
+public:
+    TextureManager() {}
+
+    // compress RGB and RGBA textures created from now on to ETC2 (see
+    // Etc2Encoder), a quarter or an eighth of their uncompressed size. 1 and 2
+    // channel textures stay uncompressed.
+    // ------------------------------------------------------------------------
+    void setCompression(bool enabled, Etc2Encoder::Quality quality = Etc2Encoder::Fast)
+    {
+        compress = enabled;
+        encoder = Etc2Encoder(quality);
+        this->quality = quality;
+    }
+    // error and throughput of everything compressed so far
+    const Etc2Encoder::Stats &compressionStats() const
+    {
+        return encoder.stats();
+    }
+
+    // look image files up in a cache of decoded (and compressed) textures
+    // before decoding them, and store them there after; nullptr to stop. the
+    // cache isn't owned and has to outlive its use here.
+    // ------------------------------------------------------------------------
+    void setCache(TextureCache *cache)
+    {
+        this->cache = cache;
+    }
+
+    // keep the textures' GPU memory, mips included, under budget bytes (0 for
+    // no limit). when they don't fit, textures idle for more than a frame are
+    // evicted, least recently bound first; if that isn't enough, the least
+    // recently bound ones lose their top mip level until they do. evicted
+    // textures are decoded from their file again in the beginFrame() after
+    // they're next bound, as are dropped mips once the budget has room for
+    // them. textures created from pixels have no file, so they're never
+    // evicted and their dropped mips stay dropped. dropping a level copies
+    // the rest on the GPU; where glCopyImageSubData isn't available, the
+    // texture is evicted instead and reloaded with the levels that fit.
+    // ------------------------------------------------------------------------
+    void setBudget(size_t bytes)
+    {
+        budget = bytes;
+        enforceBudget();
+    }
+    size_t residentBytes() const
+    {
+        return resident;
+    }
+    // start a new frame, between frames; binds are stamped with the frame to
+    // find the least recently used textures. textures bound since the last
+    // call that were evicted or are missing levels are reloaded here.
+    // ------------------------------------------------------------------------
+    void beginFrame()
+    {
+        ++frame;
+        reloadWanted();
+        enforceBudget();
+    }
+
+    // decode an image file and upload it. loading the same path again, or a
+    // file with the same pixels, returns the texture created the first time.
+    // srgb says whether the color channels are sRGB encoded (photos, albedo)
+    // rather than data (normals, heights); it only affects mip filtering.
+    // ------------------------------------------------------------------------
+    Texture load(const std::string &path, bool srgb = true)
+    {
+        auto found = byPath.find(path);
+        if (found != byPath.end())
+            return textures[found->second].texture;
+
+        MipChain chain;
+        std::vector<unsigned char> blocks;
+        uint64_t key = cache ? cache->key(path, variant(srgb, compress)) : 0;
+        bool cached = key && cache->find(key, chain, blocks);
+        if (!cached && !decode(path, srgb, chain))
+        {
+            std::cout << "ERROR::TEXTURE::FAILED_TO_LOAD: " << path << " (" << stbi_failure_reason() << ")" << std::endl;
+            return Texture();
+        }
+        Texture texture = create(chain, &blocks);
+        // a texture that turned out to match a loaded one got no blocks to store
+        if (texture.ID && key && !cached && (!compressed(chain.channels) || !blocks.empty()))
+            cache->store(key, chain, blocks);
+        if (texture.ID)
+        {
+            byPath[path] = texture.handle;
+            // the file is where the texture gets reloaded from after eviction
+            Entry &entry = textures[texture.handle];
+            if (entry.path.empty())
+            {
+                entry.path = path;
+                entry.variant = variant(srgb, compress);
+            }
+        }
+        return texture;
+    }
+    // upload already decoded 8-bit pixels with 1 to 4 channels, tightly packed.
+    // the mip chain is filtered on the CPU (see MipChain) and the whole chain
+    // is allocated up front with immutable storage.
+    // ------------------------------------------------------------------------
+    Texture create(const unsigned char *pixels, int width, int height, int channels, bool srgb = true)
+    {
+        if (!pixels || width <= 0 || height <= 0 || channels < 1 || channels > 4)
+        {
+            std::cout << "ERROR::TEXTURE::INVALID_IMAGE" << std::endl;
+            return Texture();
+        }
+        uint64_t hash = contentHash(pixels, width, height, channels, srgb, compressed(channels));
+        auto found = byHash.find(hash);
+        if (found != byHash.end())
+            return textures[found->second].texture;
+        return upload(MipChain(pixels, width, height, channels, srgb), hash);
+    }
+    // upload a chain built elsewhere, e.g. on the thread that decoded the image
+    // ------------------------------------------------------------------------
+    Texture create(const MipChain &chain)
+    {
+        return create(chain, nullptr);
+    }
+    // the sampler object for a sampling state, created on first use
+    // ------------------------------------------------------------------------
+    unsigned int sampler(const SamplerState &state = SamplerState())
+    {
+        for (const auto &entry : samplers)
+            if (entry.first == state)
+                return entry.second;
+
+        GLSampler ID = GLSampler::create();
+        glSamplerParameteri(ID, GL_TEXTURE_WRAP_S, state.wrapS);
+        glSamplerParameteri(ID, GL_TEXTURE_WRAP_T, state.wrapT);
+        glSamplerParameteri(ID, GL_TEXTURE_MIN_FILTER, state.minFilter);
+        glSamplerParameteri(ID, GL_TEXTURE_MAG_FILTER, state.magFilter);
+        samplers.push_back(std::make_pair(state, std::move(ID)));
+        return samplers.back().second;
+    }
+    // bind a texture and sampler to a texture unit. a texture that was
+    // evicted or lost levels is reloaded in the next beginFrame() rather than
+    // in the middle of drawing; until then it's drawn with the levels it has,
+    // or not at all if it was evicted.
+    // ------------------------------------------------------------------------
+    void bind(unsigned int unit, const Texture &texture, unsigned int samplerID)
+    {
+        unsigned int ID = 0;
+        auto found = textures.find(texture.handle);
+        if (found != textures.end())
+        {
+            Entry &entry = found->second;
+            entry.lastUsed = frame;
+            if ((!entry.texture.ID || entry.droppedLevels) && !entry.path.empty() && !entry.wanted)
+            {
+                entry.wanted = true;
+                wanted.push_back(texture.handle);
+            }
+            ID = entry.texture.ID;
+        }
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, ID);
+        glBindSampler(unit, samplerID);
+    }
+
+private:
+    struct Entry
+    {
+        Texture texture;        // as it is on the GPU now; ID is 0 while evicted
+        GLTexture object;       // owns texture.ID
+        Texture created;        // as it was first uploaded, with every level
+        std::string path;       // file to reload from; empty ones are never evicted
+        bool srgb = true;
+        uint64_t variant = 0;   // what the file is cached under, with the path
+        int droppedLevels = 0;  // top mips dropped to fit the budget
+        size_t bytes = 0;
+        uint64_t lastUsed = 0;
+        bool wanted = false;    // waiting in wanted for beginFrame to reload it
+    };
+
+    std::unordered_map<unsigned int, Entry> textures;
+    std::unordered_map<std::string, unsigned int> byPath;
+    std::unordered_map<uint64_t, unsigned int> byHash;
+    std::vector<unsigned int> wanted;   // handles bound while evicted or missing levels
+    unsigned int nextHandle = 1;
+    // only a handful of distinct states exist, so a linear search is fine
+    std::vector<std::pair<SamplerState, GLSampler>> samplers;
+    bool compress = false;
+    Etc2Encoder::Quality quality = Etc2Encoder::Fast;
+    Etc2Encoder encoder;
+    TextureCache *cache = nullptr;
+    size_t budget = 0;
+    size_t resident = 0;
+    uint64_t frame = 0;
+    int copyImages = -1;    // whether glCopyImageSubData works; -1 until asked
+
+    bool compressed(int channels) const
+    {
+        return compress && (channels == 3 || channels == 4);
+    }
+
+    // blocks, if given, holds the chain's compressed levels from the cache,
+    // or is empty and gets them as they're encoded
+    Texture create(const MipChain &chain, std::vector<unsigned char> *blocks)
+    {
+        if (chain.levels.empty() || chain.channels < 1 || chain.channels > 4)
+        {
+            std::cout << "ERROR::TEXTURE::INVALID_IMAGE" << std::endl;
+            return Texture();
+        }
+        const MipChain::Level &base = chain.levels[0];
+        uint64_t hash = contentHash(chain.pixels(0), base.width, base.height, chain.channels, chain.srgb, compressed(chain.channels));
+        auto found = byHash.find(hash);
+        if (found != byHash.end())
+            return textures[found->second].texture;
+        return upload(chain, hash, blocks);
+    }
+    Texture upload(const MipChain &chain, uint64_t hash, std::vector<unsigned char> *blocks = nullptr)
+    {
+        unsigned int handle = nextHandle++;
+        Entry &entry = textures[handle];
+        entry.texture = allocate(chain, 0, compressed(chain.channels), blocks);
+        entry.object.reset(entry.texture.ID);
+        entry.texture.handle = handle;
+        entry.created = entry.texture;
+        entry.srgb = chain.srgb;
+        entry.bytes = textureBytes(entry.texture);
+        entry.lastUsed = frame;
+        resident += entry.bytes;
+        byHash[hash] = handle;
+        Texture texture = entry.texture;
+        enforceBudget();
+        return texture;
+    }
+    // a texture holding the chain's levels from first down, for an entry's
+    // object to take over. blocks is as for create(); it's only filled in
+    // when every level is uploaded.
+    Texture allocate(const MipChain &chain, int first, bool etc2, std::vector<unsigned char> *blocks = nullptr)
+    {
+        static const GLenum internalFormats[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+        Texture texture;
+        texture.width = chain.levels[first].width;
+        texture.height = chain.levels[first].height;
+        texture.channels = chain.channels;
+        texture.levels = (int)chain.levels.size() - first;
+        texture.internalFormat = etc2 ? Etc2Encoder::format(chain.channels) : internalFormats[chain.channels - 1];
+
+        glGenTextures(1, &texture.ID);
+        glBindTexture(GL_TEXTURE_2D, texture.ID);
+        glTexStorage2D(GL_TEXTURE_2D, texture.levels, texture.internalFormat, texture.width, texture.height);
+        if (etc2)
+        {
+            // every level is compressed on its own, including the ones smaller
+            // than a 4x4 block
+            size_t expected = 0;
+            for (const MipChain::Level &mip : chain.levels)
+                expected += Etc2Encoder::compressedSize(mip.width, mip.height, chain.channels);
+            bool cached = blocks && blocks->size() == expected;
+            bool collect = blocks && !cached && first == 0;
+            if (collect)
+                blocks->clear();
+            size_t offset = 0;
+            for (int level = 0; level < (int)chain.levels.size(); ++level)
+            {
+                const MipChain::Level &mip = chain.levels[level];
+                size_t size = Etc2Encoder::compressedSize(mip.width, mip.height, chain.channels);
+                if (level >= first)
+                {
+                    std::vector<unsigned char> encoded;
+                    const unsigned char *data = cached ? blocks->data() + offset : nullptr;
+                    if (!data)
+                    {
+                        encoded = encoder.encode(chain.pixels(level), mip.width, mip.height, chain.channels);
+                        data = encoded.data();
+                        if (collect)
+                            blocks->insert(blocks->end(), encoded.begin(), encoded.end());
+                    }
+                    glCompressedTexSubImage2D(GL_TEXTURE_2D, level - first, 0, 0, mip.width, mip.height, texture.internalFormat, (GLsizei)size, data);
+                }
+                offset += size;
+            }
+        }
+        else
+        {
+            // rows of 1 and 3 channel images are only as aligned as their width allows
+            GLint previousAlignment;
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+            for (int level = 0; level < texture.levels; ++level)
+            {
+                const MipChain::Level &mip = chain.levels[first + level];
+                glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment(mip.width * chain.channels));
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mip.width, mip.height, formats[chain.channels - 1], GL_UNSIGNED_BYTE, chain.pixels(first + level));
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        }
+        return texture;
+    }
+
+    static bool isCompressed(const Texture &texture)
+    {
+        return texture.internalFormat == GL_COMPRESSED_RGB8_ETC2 || texture.internalFormat == GL_COMPRESSED_RGBA8_ETC2_EAC;
+    }
+    // bytes of the texture's levels from first down
+    static size_t textureBytes(const Texture &texture, int first = 0)
+    {
+        size_t total = 0;
+        int width = texture.width, height = texture.height;
+        for (int level = 0; level < texture.levels; ++level)
+        {
+            if (level >= first)
+                total += isCompressed(texture) ? Etc2Encoder::compressedSize(width, height, texture.channels)
+                                               : (size_t)width * height * texture.channels;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return total;
+    }
+
+    void enforceBudget()
+    {
+        if (!budget || resident <= budget)
+            return;
+        std::vector<Entry*> order;
+        for (auto &entry : textures)
+            if (entry.second.texture.ID)
+                order.push_back(&entry.second);
+        std::sort(order.begin(), order.end(), [](const Entry *a, const Entry *b) { return a->lastUsed < b->lastUsed; });
+
+        // textures not bound this frame or the last leave the GPU entirely
+        for (Entry *entry : order)
+        {
+            if (resident <= budget)
+                return;
+            if (frame - entry->lastUsed > 1 && !entry->path.empty())
+                evict(*entry);
+        }
+        // the rest give up their largest level, a round at a time
+        for (bool dropped = true; dropped && resident > budget; )
+        {
+            dropped = false;
+            for (Entry *entry : order)
+            {
+                if (resident <= budget)
+                    return;
+                if (entry->texture.ID && entry->texture.levels > 1)
+                {
+                    // without glCopyImageSubData the smaller levels can only
+                    // come from the file, so the texture goes and beginFrame
+                    // reloads what fits
+                    if (canCopyImages())
+                        dropTopLevel(*entry);
+                    else if (!entry->path.empty())
+                        evict(*entry);
+                    else
+                        continue;
+                    dropped = true;
+                }
+            }
+        }
+    }
+    // the texture may still be sampled by frames in flight, so it's retired
+    // rather than deleted
+    void evict(Entry &entry)
+    {
+        entry.object.reset();
+        entry.texture.ID = 0;
+        resident -= entry.bytes;
+        entry.bytes = 0;
+    }
+    // glCopyImageSubData is core in GLES 3.2 and GL 4.3, and an extension
+    // before; asked once, since the context doesn't change
+    bool canCopyImages()
+    {
+        if (copyImages < 0)
+        {
+            const char *version = (const char *)glGetString(GL_VERSION);
+            GLint major = 0, minor = 0;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            bool es = version && std::strncmp(version, "OpenGL ES", 9) == 0;
+            copyImages = major * 10 + minor >= (es ? 32 : 43);
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count && !copyImages; ++i)
+            {
+                const char *name = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+                copyImages = name && (std::strcmp(name, "GL_ARB_copy_image") == 0 || std::strcmp(name, "GL_EXT_copy_image") == 0 ||
+                                      std::strcmp(name, "GL_OES_copy_image") == 0);
+            }
+        }
+        return copyImages != 0;
+    }
+    // the smaller levels are copied into a new texture on the GPU, so no
+    // pixels have to come back from the file
+    void dropTopLevel(Entry &entry)
+    {
+        Texture smaller = entry.texture;
+        smaller.width = std::max(1, smaller.width / 2);
+        smaller.height = std::max(1, smaller.height / 2);
+        smaller.levels -= 1;
+        GLTexture object = GLTexture::create();
+        smaller.ID = object;
+        glBindTexture(GL_TEXTURE_2D, smaller.ID);
+        glTexStorage2D(GL_TEXTURE_2D, smaller.levels, smaller.internalFormat, smaller.width, smaller.height);
+        int width = smaller.width, height = smaller.height;
+        for (int level = 0; level < smaller.levels; ++level)
+        {
+            glCopyImageSubData(entry.texture.ID, GL_TEXTURE_2D, level + 1, 0, 0, 0,
+                               smaller.ID, GL_TEXTURE_2D, level, 0, 0, 0, width, height, 1);
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+
+        resident -= entry.bytes;
+        entry.object = std::move(object);
+        entry.texture = smaller;
+        entry.bytes = textureBytes(smaller);
+        entry.droppedLevels += 1;
+        resident += entry.bytes;
+    }
+    void reloadWanted()
+    {
+        std::vector<unsigned int> handles;
+        handles.swap(wanted);
+        for (unsigned int handle : handles)
+        {
+            Entry &entry = textures[handle];
+            entry.wanted = false;
+            reload(entry);
+        }
+    }
+    // decode an evicted texture, or one missing its top levels, from its file
+    // again, with as many levels as the budget has room for. stb_image's
+    // current settings (such as the vertical flip) apply to the reload.
+    void reload(Entry &entry)
+    {
+        if (entry.path.empty())
+            return;
+        Texture &texture = entry.texture;
+        const Texture &whole = entry.created;
+        // the smallest level at the least; more if they fit
+        size_t available = budget ? budget - std::min(budget, resident - entry.bytes) : (size_t)-1;
+        int first = 0;
+        while (first + 1 < whole.levels && textureBytes(whole, first) > available)
+            ++first;
+        if (texture.ID && first >= entry.droppedLevels)
+            return;
+
+        MipChain chain;
+        std::vector<unsigned char> blocks;
+        uint64_t key = cache ? cache->key(entry.path, entry.variant) : 0;
+        if (!(key && cache->find(key, chain, blocks)) && !decode(entry.path, entry.srgb, chain))
+        {
+            std::cout << "ERROR::TEXTURE::FAILED_TO_RELOAD: " << entry.path << " (" << stbi_failure_reason() << ")" << std::endl;
+            return;
+        }
+        if ((int)chain.levels.size() != whole.levels || chain.channels != whole.channels)
+        {
+            std::cout << "ERROR::TEXTURE::FILE_CHANGED: " << entry.path << std::endl;
+            return;
+        }
+
+        if (texture.ID)
+            evict(entry);
+        texture = allocate(chain, first, isCompressed(whole), &blocks);
+        entry.object.reset(texture.ID);
+        texture.handle = whole.handle;
+        entry.droppedLevels = first;
+        entry.bytes = textureBytes(texture);
+        resident += entry.bytes;
+    }
+    static bool decode(const std::string &path, bool srgb, MipChain &chain)
+    {
+        int width, height, channels;
+        unsigned char *data = stbi_load(path.c_str(), &width, &height, &channels, 0);
+        if (!data)
+            return false;
+        chain = MipChain(data, width, height, channels, srgb);
+        stbi_image_free(data);
+        return true;
+    }
+    // what besides the file decides a cached texture's contents
+    uint64_t variant(bool srgb, bool etc2) const
+    {
+        return (uint64_t)srgb | (uint64_t)etc2 << 1 | (uint64_t)(etc2 ? quality : 0) << 2;
+    }
+    // largest alignment GL accepts that the row pitch is a multiple of
+    static int unpackAlignment(int rowBytes)
+    {
+        if (rowBytes % 8 == 0) return 8;
+        if (rowBytes % 4 == 0) return 4;
+        if (rowBytes % 2 == 0) return 2;
+        return 1;
+    }
+    // FNV-1a over the pixels, seeded with the dimensions so equal bytes in a
+    // different shape don't collide, with how the mips are filtered and with
+    // whether the texture is compressed
+    static uint64_t contentHash(const unsigned char *pixels, int width, int height, int channels, bool srgb, bool etc2)
+    {
+        size_t size = (size_t)width * height * channels;
+        uint64_t hash = 14695981039346656037ull;
+        const int header[] = { width, height, channels, srgb, etc2 };
+        const unsigned char *bytes = (const unsigned char *)header;
+        for (size_t i = 0; i < sizeof(header); ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ pixels[i]) * 1099511628211ull;
+        return hash;
+    }
+};
+#endif
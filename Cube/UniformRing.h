@@ -0,0 +1,130 @@
+#ifndef UNIFORM_RING_H
+#define UNIFORM_RING_H
+
+#include "GLHandle.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+// one large uniform buffer split into a region per frame in flight. each
+// frame the next region is mapped once, filled with that frame's uniform
+// blocks and unmapped, and draws pick their block out of it with
+// glBindBufferRange. the map is unsynchronized: a fence placed after the
+// frame's draws says when the GPU is done with a region, and begin() only
+// waits on it when the ring comes round to that region again.
+//
+// a frame goes begin(), push() for every block, end(), then draws that
+// bind() the offsets push() returned, then fence(). the buffer can't be used
+// for drawing while it's mapped, which is why the pushes come first.
+class UniformRing
+{
+public:
+    GLBuffer ID;
+
+    explicit UniformRing(size_t bytesPerFrame = 64 * 1024, int frames = 3)
+        : frames(std::max(1, std::min<int>(frames, maxFrames)))
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        align = (size_t)alignment;
+        regionBytes = roundUp(bytesPerFrame);
+        ID = GLBuffer::create();
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, regionBytes * this->frames, nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    // map the next frame's region, waiting first if the GPU may still be
+    // reading it from frames ago
+    // ------------------------------------------------------------------------
+    void begin()
+    {
+        current = (current + 1) % frames;
+        bool synchronize = false;
+        if (fences[current])
+        {
+            // mapping unsynchronized before the fence has passed would change
+            // uniforms under draws still in flight, so a timeout waits again
+            GLenum status;
+            do
+                status = glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            while (status == GL_TIMEOUT_EXPIRED);
+            if (status == GL_WAIT_FAILED)
+            {
+                // nothing says the GPU is done, so leave that to the driver
+                std::cout << "ERROR::UNIFORM_RING::WAIT_FAILED" << std::endl;
+                synchronize = true;
+            }
+            fences[current].reset();
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT | (synchronize ? 0 : GL_MAP_UNSYNCHRONIZED_BIT);
+        mapped = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, regionOffset(), regionBytes, access);
+        if (!mapped)
+            std::cout << "ERROR::UNIFORM_RING::MAP_FAILED" << std::endl;
+        used = 0;
+    }
+    // copy a std140 block into the frame's region; returns the offset to bind
+    // it at, or -1 if the region is full or not mapped
+    // ------------------------------------------------------------------------
+    template <typename Block>
+    GLintptr push(const Block &block)
+    {
+        if (!mapped || used + sizeof(Block) > regionBytes)
+        {
+            std::cout << "ERROR::UNIFORM_RING::FULL" << std::endl;
+            return -1;
+        }
+        std::memcpy(mapped + used, &block, sizeof(Block));
+        GLintptr offset = regionOffset() + (GLintptr)used;
+        used = roundUp(used + sizeof(Block));
+        return offset;
+    }
+    // flush what was pushed and unmap, so the frame can draw
+    // ------------------------------------------------------------------------
+    void end()
+    {
+        if (!mapped)
+            return;
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        if (used)
+            glFlushMappedBufferRange(GL_UNIFORM_BUFFER, 0, used);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        mapped = nullptr;
+    }
+    // bind a pushed block to a uniform block binding point
+    // ------------------------------------------------------------------------
+    template <typename Block>
+    void bind(unsigned int binding, GLintptr offset) const
+    {
+        if (offset >= 0)
+            glBindBufferRange(GL_UNIFORM_BUFFER, binding, ID, offset, sizeof(Block));
+    }
+    // after the frame's last draw that reads the ring
+    // ------------------------------------------------------------------------
+    void fence()
+    {
+        fences[current] = GLSync::fence();
+    }
+
+private:
+    enum { maxFrames = 4 };
+    int frames;
+    int current = -1;
+    size_t align = 256;
+    size_t regionBytes = 0;
+    size_t used = 0;
+    unsigned char *mapped = nullptr;
+    GLSync fences[maxFrames];
+
+    GLintptr regionOffset() const
+    {
+        return (GLintptr)(regionBytes * current);
+    }
+    size_t roundUp(size_t bytes) const
+    {
+        return (bytes + align - 1) / align * align;
+    }
+};
+#endif
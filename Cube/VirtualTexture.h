@@ -0,0 +1,501 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "Shader.h"
+#include "VirtualTextureFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <iostream>
+
+// shows an image of any size from a paged file (see VirtualTextureFile)
+// through a fixed size cache, so GPU and CPU memory don't grow with the image.
+//
+// every frame the scene is drawn small with the VT_FEEDBACK variant of
+// virtual_texture.fs, which writes the tile each pixel wants. update() reads
+// that back a frame later, queues missing tiles for a worker thread that
+// reads them from the file, and copies finished tiles into free or least
+// recently used slots of the cache texture. the indirection texture holds one
+// texel per tile of every level, pointing at the slot of the finest resident
+// tile covering it, and virtual_texture.fs samples through it. the coarsest
+// level is a single tile that stays resident, so there is always something
+// to show.
+class VirtualTexture
+{
+public:
+    // cacheTiles is the cache's size in tiles per side. the feedback pass is
+    // rendered at feedbackWidth x feedbackHeight, a fraction of the screen.
+    // ------------------------------------------------------------------------
+    VirtualTexture(const std::string &path, int cacheTiles = 8, int feedbackWidth = 160, int feedbackHeight = 120)
+        : path(path), cacheTiles(std::max(2, std::min(cacheTiles, 256))), feedbackWidth(feedbackWidth), feedbackHeight(feedbackHeight)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!file.read(in))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::INVALID_FILE: " << path << std::endl;
+            return;
+        }
+        // the coarsest tile is the last in the file, so reading it also
+        // catches a file cut short before any GL objects are made
+        int coarsest = (int)file.levels.size() - 1;
+        std::vector<unsigned char> pixels(file.tileBytes());
+        in.seekg(file.tileOffset(file.tileIndex(coarsest, 0, 0)));
+        in.read((char *)pixels.data(), pixels.size());
+        if (!in)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FAILED_TO_READ_TILE: " << path << std::endl;
+            return;
+        }
+
+        // the indirection table stacks the levels' page grids on top of each other
+        tableWidth = file.levels[0].pagesX;
+        tableHeight = 0;
+        for (const VirtualTextureFile::Level &level : file.levels)
+        {
+            levelRows.push_back(tableHeight);
+            tableHeight += level.pagesY;
+        }
+        table.assign((size_t)tableWidth * tableHeight * 4, 0);
+        slotOfTile.assign(file.tileCount(), -1);
+        slots.assign((size_t)this->cacheTiles * this->cacheTiles, Slot());
+
+        createTextures();
+        createFeedback();
+
+        // pin the coarsest tile in slot 0
+        slots[0].pinned = true;
+        place(file.tileIndex(coarsest, 0, 0), 0, pixels);
+        uploadTable();
+
+        worker = std::thread(&VirtualTexture::work, this);
+    }
+    ~VirtualTexture()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+    }
+
+    bool valid() const
+    {
+        return cache != 0;
+    }
+
+    // draw the scene with the feedback shader between these two. the
+    // feedback is read back without waiting and used by the next update().
+    // ------------------------------------------------------------------------
+    void beginFeedback()
+    {
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, savedClearColor);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+        // alpha 0 marks pixels that don't show the virtual texture
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    void endFeedback()
+    {
+        int buffer = (int)(frame & 1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[buffer]);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackPending[buffer] = true;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        glClearColor(savedClearColor[0], savedClearColor[1], savedClearColor[2], savedClearColor[3]);
+    }
+
+    // once a frame, before drawing with the virtual texture: requests the
+    // tiles the last feedback asked for and uploads the ones that arrived,
+    // at most uploadsPerFrame of them
+    // ------------------------------------------------------------------------
+    void update(int uploadsPerFrame = 16)
+    {
+        ++frame;
+        std::vector<uint64_t> wanted = readFeedback();
+        // coarse tiles first, so there is something close to show soon
+        std::sort(wanted.begin(), wanted.end(), [this](uint64_t a, uint64_t b)
+        {
+            return levelOf(a) > levelOf(b) || (levelOf(a) == levelOf(b) && a < b);
+        });
+        if (wanted.size() > slots.size())
+            wanted.resize(slots.size());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // tiles read but not uploaded yet still count, which keeps the
+            // memory held by the queues under a cache's worth of tiles
+            requests.clear();
+            for (uint64_t tile : wanted)
+            {
+                if (inFlight.size() + requests.size() >= slots.size())
+                    break;
+                if (!inFlight.count(tile))
+                    requests.push_back(tile);
+            }
+        }
+        wake.notify_one();
+
+        std::vector<std::pair<uint64_t, std::vector<unsigned char>>> arrived;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int count = std::min((int)finished.size(), uploadsPerFrame);
+            for (int i = 0; i < count; ++i)
+            {
+                inFlight.erase(finished.front().first);
+                arrived.push_back(std::move(finished.front()));
+                finished.pop_front();
+            }
+        }
+        for (const auto &tile : arrived)
+        {
+            if (slotOfTile[tile.first] >= 0)
+                continue;
+            int slot = freeSlot();
+            if (slot < 0)
+                break;
+            place(tile.first, slot, tile.second);
+        }
+        uploadTable();
+    }
+
+    // bind the cache and the indirection texture to two texture units
+    // ------------------------------------------------------------------------
+    void bind(unsigned int cacheUnit, unsigned int indirectionUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + cacheUnit);
+        glBindTexture(GL_TEXTURE_2D, cache);
+        glBindSampler(cacheUnit, 0);
+        glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+        glBindTexture(GL_TEXTURE_2D, indirection);
+        glBindSampler(indirectionUnit, 0);
+    }
+    // the uniforms both virtual texture shaders read; the shader has to be in use
+    // ------------------------------------------------------------------------
+    void setUniforms(const Shader &shader) const
+    {
+        shader.setVec2("vtSize"_u, (float)file.width, (float)file.height);
+        shader.setInt("vtLevels"_u, (int)file.levels.size());
+        shader.setFloat("vtTileSize"_u, (float)file.tileSize);
+        shader.setFloat("vtBorder"_u, (float)file.border);
+        shader.setFloat("vtCacheSize"_u, (float)(cacheTiles * file.tileTexels()));
+        for (size_t i = 0; i < levelRows.size(); ++i)
+            shader.setInt("vtLevelRow[" + std::to_string(i) + "]", levelRows[i]);
+    }
+    // the feedback buffer is smaller than the screen, so its derivatives are
+    // larger; this bias for the feedback pass makes up for it
+    float feedbackLodBias(int screenWidth, int screenHeight) const
+    {
+        return -0.5f * std::log2(((float)screenWidth / feedbackWidth) * ((float)screenHeight / feedbackHeight));
+    }
+
+    int residentTiles() const
+    {
+        int count = 0;
+        for (const Slot &slot : slots)
+            count += slot.tile != noTile;
+        return count;
+    }
+
+private:
+    static const uint64_t noTile = ~(uint64_t)0;
+    struct Slot
+    {
+        uint64_t tile = noTile;
+        uint64_t lastUsed = 0;
+        bool pinned = false;
+    };
+
+    std::string path;
+    VirtualTextureFile file;
+    int cacheTiles;
+    int feedbackWidth;
+    int feedbackHeight;
+
+    GLTexture cache;
+    GLTexture indirection;
+    GLFramebuffer feedbackFramebuffer;
+    GLRenderbuffer feedbackRenderbuffers[2];
+    GLBuffer readbackBuffers[2];
+    bool readbackPending[2] = { false, false };
+    GLint savedFramebuffer = 0;
+    GLint savedViewport[4];
+    GLfloat savedClearColor[4];
+
+    // indirection entries as RGBA8: slot x, slot y, level of the tile, 255
+    std::vector<unsigned char> table;
+    int tableWidth = 0;
+    int tableHeight = 0;
+    std::vector<int> levelRows;
+    int dirtyFirstRow = 0;
+    int dirtyEndRow = 0;
+
+    std::vector<int> slotOfTile;
+    std::vector<Slot> slots;
+    uint64_t frame = 0;
+
+    // shared with the worker
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<uint64_t> requests;
+    std::deque<std::pair<uint64_t, std::vector<unsigned char>>> finished;
+    std::unordered_set<uint64_t> inFlight;
+    bool stopping = false;
+
+    void createTextures()
+    {
+        int size = cacheTiles * file.tileTexels();
+        cache = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, cache);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size, size);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        indirection = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, indirection);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, tableWidth, tableHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    void createFeedback()
+    {
+        for (GLRenderbuffer &renderbuffer : feedbackRenderbuffers)
+            renderbuffer = GLRenderbuffer::create();
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, feedbackWidth, feedbackHeight);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, feedbackWidth, feedbackHeight);
+
+        GLint previous;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+        feedbackFramebuffer = GLFramebuffer::create();
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackRenderbuffers[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackRenderbuffers[1]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+        for (GLBuffer &buffer : readbackBuffers)
+        {
+            buffer = GLBuffer::create();
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)feedbackWidth * feedbackHeight * 4, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    int levelOf(uint64_t tile) const
+    {
+        int level = 0;
+        while (level + 1 < (int)file.levels.size() && tile >= file.levels[level + 1].firstTile)
+            ++level;
+        return level;
+    }
+
+    // the tiles the previous frame's feedback asked for, and the coarser
+    // tiles above them; all of them count as used this frame
+    std::vector<uint64_t> readFeedback()
+    {
+        std::vector<uint64_t> wanted;
+        int buffer = (int)((frame - 1) & 1);
+        if (!readbackPending[buffer])
+            return wanted;
+        readbackPending[buffer] = false;
+
+        size_t size = (size_t)feedbackWidth * feedbackHeight * 4;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[buffer]);
+        const unsigned char *pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        std::vector<uint64_t> seen;
+        if (pixels)
+        {
+            uint32_t previous = 0;
+            for (size_t i = 0; i < size; i += 4)
+            {
+                if (pixels[i + 3] != 255)
+                    continue;
+                uint32_t packed = pixels[i] | (uint32_t)pixels[i + 1] << 8 | (uint32_t)pixels[i + 2] << 16;
+                // neighbouring pixels mostly want the same tile
+                if (packed == previous && !seen.empty())
+                    continue;
+                previous = packed;
+                int level = pixels[i + 2] >> 4;
+                int x = pixels[i] | (pixels[i + 2] & 3) << 8;
+                int y = pixels[i + 1] | ((pixels[i + 2] >> 2) & 3) << 8;
+                if (level >= (int)file.levels.size())
+                    continue;
+                const VirtualTextureFile::Level &info = file.levels[level];
+                seen.push_back(file.tileIndex(level, std::min(x, (int)info.pagesX - 1), std::min(y, (int)info.pagesY - 1)));
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        std::sort(seen.begin(), seen.end());
+        seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+        std::unordered_set<uint64_t> added;
+        for (uint64_t tile : seen)
+        {
+            int level = levelOf(tile);
+            uint64_t index = tile - file.levels[level].firstTile;
+            int x = (int)(index % file.levels[level].pagesX), y = (int)(index / file.levels[level].pagesX);
+            for (; level < (int)file.levels.size(); ++level, x >>= 1, y >>= 1)
+            {
+                uint64_t ancestor = file.tileIndex(level, x, y);
+                if (!added.insert(ancestor).second)
+                    break;
+                if (slotOfTile[ancestor] >= 0)
+                    slots[slotOfTile[ancestor]].lastUsed = frame;
+                else
+                    wanted.push_back(ancestor);
+            }
+        }
+        return wanted;
+    }
+
+    // an empty slot, or the least recently used one not needed this frame
+    int freeSlot()
+    {
+        int best = -1;
+        for (int i = 0; i < (int)slots.size(); ++i)
+        {
+            const Slot &slot = slots[i];
+            if (slot.pinned)
+                continue;
+            if (slot.tile == noTile)
+                return i;
+            if (slot.lastUsed < frame && (best < 0 || slot.lastUsed < slots[best].lastUsed))
+                best = i;
+        }
+        if (best >= 0)
+        {
+            uint64_t evicted = slots[best].tile;
+            slotOfTile[evicted] = -1;
+            slots[best].tile = noTile;
+            refresh(evicted);
+        }
+        return best;
+    }
+    void place(uint64_t tile, int slot, const std::vector<unsigned char> &pixels)
+    {
+        int texels = file.tileTexels();
+        glBindTexture(GL_TEXTURE_2D, cache);
+        GLint previousAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheTiles) * texels, (slot / cacheTiles) * texels, texels, texels, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+
+        slots[slot].tile = tile;
+        slots[slot].lastUsed = frame;
+        slotOfTile[tile] = slot;
+        refresh(tile);
+    }
+
+    // point every table entry under a tile that came or went at the finest
+    // resident tile covering it
+    void refresh(uint64_t tile)
+    {
+        int top = levelOf(tile);
+        uint64_t index = tile - file.levels[top].firstTile;
+        int tileX = (int)(index % file.levels[top].pagesX), tileY = (int)(index / file.levels[top].pagesX);
+        for (int level = top; level >= 0; --level)
+        {
+            const VirtualTextureFile::Level &info = file.levels[level];
+            int shift = top - level;
+            int x0 = tileX << shift, y0 = tileY << shift;
+            int x1 = std::min((tileX + 1) << shift, (int)info.pagesX), y1 = std::min((tileY + 1) << shift, (int)info.pagesY);
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x)
+                    entry(level, x, y, &table[((size_t)(levelRows[level] + y) * tableWidth + x) * 4]);
+            if (y0 < y1)
+            {
+                dirtyFirstRow = dirtyFirstRow < dirtyEndRow ? std::min(dirtyFirstRow, levelRows[level] + y0) : levelRows[level] + y0;
+                dirtyEndRow = std::max(dirtyEndRow, levelRows[level] + y1);
+            }
+        }
+    }
+    void entry(int level, int x, int y, unsigned char *out) const
+    {
+        for (; level < (int)file.levels.size(); ++level, x >>= 1, y >>= 1)
+        {
+            int slot = slotOfTile[file.tileIndex(level, x, y)];
+            if (slot >= 0)
+            {
+                out[0] = (unsigned char)(slot % cacheTiles);
+                out[1] = (unsigned char)(slot / cacheTiles);
+                out[2] = (unsigned char)level;
+                out[3] = 255;
+                return;
+            }
+        }
+    }
+    void uploadTable()
+    {
+        if (dirtyFirstRow >= dirtyEndRow)
+            return;
+        glBindTexture(GL_TEXTURE_2D, indirection);
+        GLint previousAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, dirtyFirstRow, tableWidth, dirtyEndRow - dirtyFirstRow, GL_RGBA, GL_UNSIGNED_BYTE, &table[(size_t)dirtyFirstRow * tableWidth * 4]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        dirtyFirstRow = dirtyEndRow = 0;
+    }
+
+    // the worker reads requested tiles from the file in the order update()
+    // queued them
+    void work()
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<unsigned char> pixels;
+        for (;;)
+        {
+            uint64_t tile;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !requests.empty(); });
+                if (stopping)
+                    return;
+                tile = requests.front();
+                requests.pop_front();
+                inFlight.insert(tile);
+            }
+            pixels.resize(file.tileBytes());
+            in.clear();
+            in.seekg(file.tileOffset(tile));
+            in.read((char *)pixels.data(), pixels.size());
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!in)
+            {
+                std::cout << "ERROR::VIRTUAL_TEXTURE::FAILED_TO_READ_TILE: " << tile << std::endl;
+                inFlight.erase(tile);
+                continue;
+            }
+            finished.emplace_back(tile, std::move(pixels));
+            pixels = std::vector<unsigned char>();
+        }
+    }
+};
+#endif
@@ -0,0 +1,295 @@
+#ifndef VIRTUAL_TEXTURE_FILE_H
+#define VIRTUAL_TEXTURE_FILE_H
+
+#include "stb_image.h"
+#include "MipChain.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// the paged file behind a VirtualTexture: a header, then the tiles of every
+// mip level as fixed size RGBA8 pages, finest level first and row by row, so
+// any tile is one seek and one read away. a tile is tileSize texels square
+// plus a border on every side copied from its neighbours, which lets the
+// physical cache filter across tile edges.
+//
+// the image is padded with its edges to a multiple of 2^(levels - 1) so every
+// level is exactly half the one before, and the coarsest level is one tile.
+// nothing in here touches GL, so offline tools can use it on their own.
+struct VirtualTextureFile
+{
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t pagesX;
+        uint32_t pagesY;
+        uint64_t firstTile;
+    };
+
+    uint32_t width = 0;       // the image's own size, without the padding
+    uint32_t height = 0;
+    uint32_t tileSize = 0;
+    uint32_t border = 0;
+    std::vector<Level> levels;
+
+    // the feedback pass packs a tile's x and y into 10 bits each, so no level
+    // can be more tiles across than this
+    static const uint32_t maxPages = 1024;
+
+    uint32_t tileTexels() const
+    {
+        return tileSize + 2 * border;
+    }
+    size_t tileBytes() const
+    {
+        return (size_t)tileTexels() * tileTexels() * 4;
+    }
+    uint64_t tileCount() const
+    {
+        return levels.empty() ? 0 : levels.back().firstTile + (uint64_t)levels.back().pagesX * levels.back().pagesY;
+    }
+    uint64_t tileIndex(int level, int x, int y) const
+    {
+        return levels[level].firstTile + (uint64_t)y * levels[level].pagesX + x;
+    }
+    uint64_t tileOffset(uint64_t index) const
+    {
+        return headerBytes() + index * tileBytes();
+    }
+
+    // read the header of a paged file; false if it isn't one, or is one
+    // this renderer can't address
+    // ------------------------------------------------------------------------
+    bool read(std::istream &in)
+    {
+        uint32_t header[6];
+        for (uint32_t &value : header)
+            value = readU32(in);
+        if (!in || header[0] != magic || header[3] == 0 || header[5] == 0 || header[5] > 16)
+            return false;
+        width = header[1];
+        height = header[2];
+        tileSize = header[3];
+        border = header[4];
+        levels.resize(header[5]);
+        uint64_t tiles = 0;
+        for (Level &level : levels)
+        {
+            level.width = readU32(in);
+            level.height = readU32(in);
+            level.pagesX = readU32(in);
+            level.pagesY = readU32(in);
+            level.firstTile = tiles;
+            tiles += (uint64_t)level.pagesX * level.pagesY;
+            if (level.pagesX == 0 || level.pagesY == 0 || level.pagesX > maxPages || level.pagesY > maxPages)
+                return false;
+        }
+        // the coarsest level is the one tile that is always resident
+        return in && levels.back().pagesX == 1 && levels.back().pagesY == 1;
+    }
+
+    // cut an image file into a paged file. the levels are built a strip at a
+    // time, each level holding only the rows its current row of tiles needs,
+    // so memory goes with the image's width rather than its area. a binary
+    // PPM or PGM is read straight from a file mapping; stb_image can only
+    // decode other formats whole, so convert really large images to PPM
+    // first. rows are stored as decoded: set stb_image's vertical flip the
+    // same way as for ordinary textures.
+    // ------------------------------------------------------------------------
+    static bool tile(const std::string &source, const std::string &destination, int tileSize = 128, int border = 1, bool srgb = true)
+    {
+        // the mapping can only be used unflipped, so flip by reading it bottom up
+        int flip = stbi_get_flip_vertically_on_load();
+        stbi_set_flip_vertically_on_load_thread(0);
+        int width, height, channels;
+        void *mapping = nullptr;
+        const unsigned char *data = stbi_pnm_map(source.c_str(), &width, &height, &channels, 0, &mapping);
+        stbi_set_flip_vertically_on_load_thread(flip);
+        if (!data)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FAILED_TO_LOAD: " << source << " (" << stbi_failure_reason() << ")" << std::endl;
+            return false;
+        }
+
+        VirtualTextureFile file;
+        file.width = width;
+        file.height = height;
+        file.tileSize = tileSize;
+        file.border = border;
+        int levelCount = 1;
+        while (((width + (1 << (levelCount - 1)) - 1) >> (levelCount - 1)) > tileSize ||
+               ((height + (1 << (levelCount - 1)) - 1) >> (levelCount - 1)) > tileSize)
+            ++levelCount;
+        int align = 1 << (levelCount - 1);
+        int paddedWidth = (width + align - 1) / align * align;
+        int paddedHeight = (height + align - 1) / align * align;
+
+        uint64_t tiles = 0;
+        for (int level = 0; level < levelCount; ++level)
+        {
+            Level info;
+            info.width = paddedWidth >> level;
+            info.height = paddedHeight >> level;
+            info.pagesX = (info.width + tileSize - 1) / tileSize;
+            info.pagesY = (info.height + tileSize - 1) / tileSize;
+            info.firstTile = tiles;
+            tiles += (uint64_t)info.pagesX * info.pagesY;
+            file.levels.push_back(info);
+        }
+        if (file.levels[0].pagesX > maxPages || file.levels[0].pagesY > maxPages)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::TOO_LARGE: " << source << " is over " << maxPages << " tiles across" << std::endl;
+            stbi_pnm_unmap(mapping);
+            return false;
+        }
+
+        std::ofstream out(destination, std::ios::binary);
+        file.write(out);
+        StripWriter writer(file, out, srgb);
+        // the padding, and the rows and columns past the image, repeat its edges
+        std::vector<unsigned char> row((size_t)paddedWidth * 4);
+        for (int y = 0; y < paddedHeight && out; ++y)
+        {
+            int sourceRow = std::min(y, height - 1);
+            const unsigned char *in = data + (size_t)(flip ? height - 1 - sourceRow : sourceRow) * width * channels;
+            for (int x = 0; x < paddedWidth; ++x)
+            {
+                const unsigned char *texel = in + (size_t)std::min(x, width - 1) * channels;
+                unsigned char *rgba = &row[(size_t)x * 4];
+                rgba[0] = texel[0];
+                rgba[1] = channels < 3 ? texel[0] : texel[1];
+                rgba[2] = channels < 3 ? texel[0] : texel[2];
+                rgba[3] = channels == 2 || channels == 4 ? texel[channels - 1] : 255;
+            }
+            writer.add(0, row.data());
+        }
+        stbi_pnm_unmap(mapping);
+        if (!out)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FAILED_TO_WRITE: " << destination << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static const uint32_t magic = 0x31585456; // "VTX1"
+
+    // builds the levels for tile() row by row. every row a level receives
+    // goes into a ring of the last tileTexels() rows, which is all a row of
+    // tiles spans, and each pair of rows is halved into a row of the next
+    // level. a row of tiles is written out, at its place in the file, as
+    // soon as the last row it needs arrives.
+    struct StripWriter
+    {
+        struct Strip
+        {
+            std::vector<unsigned char> rows;
+            std::vector<unsigned char> pair;
+            uint32_t rowCount = 0;
+            uint32_t pageRow = 0;
+        };
+
+        const VirtualTextureFile &file;
+        std::ostream &out;
+        bool srgb;
+        std::vector<Strip> strips;
+        std::vector<unsigned char> tile;
+
+        StripWriter(const VirtualTextureFile &file, std::ostream &out, bool srgb)
+            : file(file), out(out), srgb(srgb), strips(file.levels.size()), tile(file.tileBytes())
+        {
+            for (size_t level = 0; level < strips.size(); ++level)
+            {
+                size_t rowBytes = (size_t)file.levels[level].width * 4;
+                strips[level].rows.resize(rowBytes * file.tileTexels());
+                if (level + 1 < strips.size())
+                    strips[level].pair.resize(rowBytes * 2);
+            }
+        }
+
+        void add(size_t level, const unsigned char *row)
+        {
+            const Level &info = file.levels[level];
+            Strip &strip = strips[level];
+            size_t rowBytes = (size_t)info.width * 4;
+            uint32_t y = strip.rowCount++;
+            std::copy(row, row + rowBytes, &strip.rows[(y % file.tileTexels()) * rowBytes]);
+            while (strip.pageRow < info.pagesY && std::min((strip.pageRow + 1) * file.tileSize + file.border, info.height) - 1 <= y)
+                writePageRow(level, strip.pageRow++);
+
+            // every level but the coarsest has an even size, so a pair of rows
+            // halves to exactly one row of the next
+            if (level + 1 < strips.size())
+            {
+                std::copy(row, row + rowBytes, &strip.pair[(y & 1) * rowBytes]);
+                if (y & 1)
+                {
+                    MipChain halved(strip.pair.data(), info.width, 2, 4, srgb, 2);
+                    add(level + 1, halved.pixels(1));
+                }
+            }
+        }
+
+        // the border, and the part of edge tiles past the level, repeat the
+        // nearest texel
+        void writePageRow(size_t level, uint32_t py)
+        {
+            const Level &info = file.levels[level];
+            const Strip &strip = strips[level];
+            int texels = file.tileTexels();
+            int tileSize = file.tileSize, border = file.border;
+            for (uint32_t px = 0; px < info.pagesX; ++px)
+            {
+                for (int j = 0; j < texels; ++j)
+                {
+                    int sy = std::max(0, std::min((int)info.height - 1, (int)py * tileSize - border + j));
+                    const unsigned char *in = &strip.rows[(size_t)(sy % texels) * info.width * 4];
+                    for (int i = 0; i < texels; ++i)
+                    {
+                        int sx = std::max(0, std::min((int)info.width - 1, (int)px * tileSize - border + i));
+                        std::copy(in + (size_t)sx * 4, in + (size_t)sx * 4 + 4, &tile[((size_t)j * texels + i) * 4]);
+                    }
+                }
+                out.seekp(file.tileOffset(file.tileIndex((int)level, px, py)));
+                out.write((const char *)tile.data(), tile.size());
+            }
+        }
+    };
+
+    uint64_t headerBytes() const
+    {
+        return 6 * 4 + levels.size() * 4 * 4;
+    }
+    void write(std::ostream &out) const
+    {
+        const uint32_t header[] = { magic, width, height, tileSize, border, (uint32_t)levels.size() };
+        for (uint32_t value : header)
+            writeU32(out, value);
+        for (const Level &level : levels)
+        {
+            writeU32(out, level.width);
+            writeU32(out, level.height);
+            writeU32(out, level.pagesX);
+            writeU32(out, level.pagesY);
+        }
+    }
+    // the file is little endian whatever the machine
+    static void writeU32(std::ostream &out, uint32_t value)
+    {
+        const char bytes[] = { (char)(value & 0xff), (char)((value >> 8) & 0xff), (char)((value >> 16) & 0xff), (char)(value >> 24) };
+        out.write(bytes, 4);
+    }
+    static uint32_t readU32(std::istream &in)
+    {
+        unsigned char bytes[4] = { 0, 0, 0, 0 };
+        in.read((char *)bytes, 4);
+        return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    }
+};
+#endif
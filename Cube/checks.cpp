@@ -0,0 +1,495 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl32.h>
+#include "TextureManager.h"
+#include "GLHandle.h"
+#include "MipChain.h"
+#include "ShaderPipeline.h"
+#include "ShaderVariants.h"
+#include "VirtualTexture.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// checks for the parts of Cube that only run with a GL context, made without
+// a window so they run anywhere Mesa's llvmpipe does. run from this
+// directory, as Cube is; exits with 1 if any check failed.
+
+int failures = 0;
+// every allocation made through operator new, from any thread
+std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size)
+{
+    ++allocations;
+    if (void *memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+void check(bool passed, const char *what)
+{
+    if (!passed)
+    {
+        std::cout << "ERROR::CHECKS::FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+/* A GL 3.3 core context with no surface; Cube's shaders are GLSL 3.30 */
+bool setupcontext()
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (!eglInitialize(display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API))
+        return false;
+
+    const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = nullptr;
+    EGLint configs = 0;
+    eglChooseConfig(display, configAttributes, &config, 1, &configs);
+    const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                         EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+    EGLContext context = eglCreateContext(display, configs ? config : nullptr, EGL_NO_CONTEXT, contextAttributes);
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+GLint boundTexture(unsigned int unit)
+{
+    GLint ID = 0;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &ID);
+    return ID;
+}
+
+GLint boundWidth(unsigned int unit)
+{
+    GLint width = 0;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    return width;
+}
+
+// evicting and dropping mips to fit the budget, and reloading in beginFrame
+// rather than at bind
+void checkTextureBudget()
+{
+    TextureManager textures;
+    Texture box = textures.load("container.jpg");
+    Texture face = textures.load("awesomeface.png");
+    unsigned int sampler = textures.sampler();
+    size_t both = textures.residentBytes();
+    check(box.ID && face.ID, "texture load");
+
+    // the face goes idle while the box is drawn, so it's the one evicted
+    for (int frame = 0; frame < 3; ++frame)
+    {
+        textures.beginFrame();
+        textures.bind(0, box, sampler);
+    }
+    textures.setBudget(both - 1);
+    size_t boxBytes = textures.residentBytes();
+    check(boxBytes < both, "idle texture evicted over budget");
+
+    textures.bind(1, face, sampler);
+    check(boundTexture(1) == 0 && textures.residentBytes() == boxBytes, "evicted texture not reloaded at bind");
+    textures.beginFrame();
+    textures.bind(1, face, sampler);
+    check(boundTexture(1) != 0, "evicted texture reloaded by beginFrame");
+    check(textures.residentBytes() <= both - 1, "reload fits the budget");
+
+    // both were bound lately, so they give up top levels instead
+    textures.setBudget(boxBytes / 2);
+    textures.bind(0, box, sampler);
+    check(textures.residentBytes() <= boxBytes / 2, "top levels dropped to fit the budget");
+    check(boundWidth(0) < box.width, "dropped texture bound smaller");
+
+    textures.setBudget(0);
+    textures.bind(0, box, sampler);
+    check(boundWidth(0) < box.width, "dropped levels not reloaded at bind");
+    textures.beginFrame();
+    textures.bind(0, box, sampler);
+    check(boundWidth(0) == box.width, "dropped levels reloaded by beginFrame");
+
+    GLDeletionQueue::shared().flush();
+    check(glGetError() == GL_NO_ERROR, "texture budget GL errors");
+}
+
+// the Frame and Draw blocks of 6.2.coordinate_systems.vs with identity
+// transforms, bound at 0 and 1, so a quad from -1 to 1 covers the target
+void identityTransforms(GLBuffer &frameBlock, GLBuffer &drawBlock)
+{
+    float uniforms[16 * 3 + 4] = {};
+    for (int matrix = 0; matrix < 3; ++matrix)
+        for (int i = 0; i < 4; ++i)
+            uniforms[matrix * 16 + i * 5] = 1.0f;
+    frameBlock = GLBuffer::create();
+    drawBlock = GLBuffer::create();
+    glBindBuffer(GL_UNIFORM_BUFFER, frameBlock);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(uniforms), uniforms, GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, drawBlock);
+    glBufferData(GL_UNIFORM_BUFFER, 16 * sizeof(float), uniforms, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, frameBlock);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, drawBlock);
+}
+
+// a quad covering the target, laid out like the cube's vertices, bound
+void screenQuad(GLVertexArray &vertexArray, GLBuffer &vertices)
+{
+    const float quad[] = {
+        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,   1.0f, -1.0f, 0.0f, 1.0f, 0.0f,   1.0f, 1.0f, 0.0f, 1.0f, 1.0f,
+        -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,   1.0f, 1.0f, 0.0f, 1.0f, 1.0f,   -1.0f, 1.0f, 0.0f, 0.0f, 1.0f,
+    };
+    vertexArray = GLVertexArray::create();
+    vertices = GLBuffer::create();
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, vertices);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+}
+
+// an RGBA8 texture of the given size as the framebuffer, bound
+void renderTarget(GLTexture &target, GLFramebuffer &framebuffer, int width, int height)
+{
+    target = GLTexture::create();
+    glBindTexture(GL_TEXTURE_2D, target);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    framebuffer = GLFramebuffer::create();
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+    glViewport(0, 0, width, height);
+}
+
+// tiling an image and drawing it through the virtual texture shaders at one
+// texel per pixel, which once the tiles are loaded shows the image exactly
+void checkVirtualTexture()
+{
+    const char *path = "checks.vt";
+    stbi_set_flip_vertically_on_load(true);
+    check(VirtualTextureFile::tile("container.jpg", path, 32), "tile container.jpg");
+    int width, height, channels;
+    unsigned char *image = stbi_load("container.jpg", &width, &height, &channels, 4);
+
+    // the feedback pass can't address more than 1024 tiles across
+    {
+        std::ofstream wide("checks_wide.pgm", std::ios::binary);
+        wide << "P5 " << 1025 * 16 << " 1 255\n" << std::string(1025 * 16, '\x80');
+    }
+    check(!VirtualTextureFile::tile("checks_wide.pgm", "checks_wide.vt", 16), "tile over 1024 tiles across refused");
+    std::remove("checks_wide.pgm");
+    std::remove("checks_wide.vt");
+
+    // a file cut short doesn't load
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::string whole((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream cut("checks_cut.vt", std::ios::binary);
+        cut.write(whole.data(), whole.size() - 1);
+    }
+    {
+        VirtualTexture truncated("checks_cut.vt");
+        check(!truncated.valid(), "truncated file not loaded");
+    }
+    std::remove("checks_cut.vt");
+
+    VirtualTexture texture(path, 20, 128, 128);
+    check(texture.valid() && image, "virtual texture load");
+    if (!texture.valid() || !image)
+    {
+        stbi_image_free(image);
+        return;
+    }
+
+    ShaderVariants variants("6.2.coordinate_systems.vs", "virtual_texture.fs", { "VT_FEEDBACK" });
+    const uint32_t VT_FEEDBACK = variants.bit("VT_FEEDBACK");
+    variants.prewarm({ 0, VT_FEEDBACK });
+    Shader &shader = variants.get(0);
+    Shader &feedback = variants.get(VT_FEEDBACK);
+    check(shader.ID && feedback.ID, "virtual texture shaders");
+    shader.use();
+    shader.setInt("vtCache", 0);
+    shader.setInt("vtIndirection", 1);
+    texture.setUniforms(shader);
+    feedback.use();
+    texture.setUniforms(feedback);
+    feedback.setFloat("vtLodBias", texture.feedbackLodBias(width, height));
+
+    for (Shader *program : { &shader, &feedback })
+    {
+        program->bindBlock("Frame", 0);
+        program->bindBlock("Draw", 1);
+    }
+    GLBuffer frameBlock, drawBlock, vertices;
+    GLVertexArray vertexArray;
+    GLTexture target;
+    GLFramebuffer framebuffer;
+    identityTransforms(frameBlock, drawBlock);
+    screenQuad(vertexArray, vertices);
+    renderTarget(target, framebuffer, width, height);
+
+    // the tiles stream in over a few frames, coarsest first
+    for (int frame = 0; frame < 120; ++frame)
+    {
+        texture.update();
+        texture.bind(0, 1);
+        texture.beginFeedback();
+        feedback.use();
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        texture.endFeedback();
+        shader.use();
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        glFinish();
+        usleep(1000);
+    }
+
+    std::vector<unsigned char> pixels((size_t)width * height * 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    int wrong = 0;
+    for (size_t i = 0; i < pixels.size(); ++i)
+        wrong += std::abs(pixels[i] - image[i]) > 1;
+    check(wrong == 0, "virtual texture drawn at one texel per pixel matches the image");
+    stbi_image_free(image);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    std::remove(path);
+    GLDeletionQueue::shared().flush();
+    check(glGetError() == GL_NO_ERROR, "virtual texture GL errors");
+}
+
+// the smallest level of the bound GL_TEXTURE_2D, as RGBA
+void smallestTexel(int levels, unsigned char texel[4])
+{
+    GLint texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    GLFramebuffer framebuffer = GLFramebuffer::create();
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, (GLuint)texture, levels - 1);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// container.jpg's mips built by MipChain and uploaded, against uploading the
+// top level and glGenerateMipmap. the fastest of a few runs of each is
+// printed; which wins depends on the driver, so only the results are checked:
+// MipChain's last level has to be the image's mean, while how far the
+// driver's rounding drifts from it is only printed.
+void checkMipChainTiming()
+{
+    int width, height, channels;
+    unsigned char *image = stbi_load("container.jpg", &width, &height, &channels, 3);
+    check(image != nullptr, "load container.jpg for mip timing");
+    if (!image)
+        return;
+    typedef std::chrono::steady_clock Clock;
+    double cpuBest = 1e9, gpuBest = 1e9;
+    unsigned char cpuTexel[4] = {}, gpuTexel[4] = {};
+    int cpuLevels = 0, gpuLevels = 0;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int run = 0; run < 5; ++run)
+    {
+        Clock::time_point start = Clock::now();
+        MipChain chain(image, width, height, 3, false);
+        cpuLevels = (int)chain.levels.size();
+        GLTexture cpu = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, cpu);
+        glTexStorage2D(GL_TEXTURE_2D, cpuLevels, GL_RGB8, width, height);
+        for (int level = 0; level < cpuLevels; ++level)
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, chain.levels[level].width, chain.levels[level].height,
+                            GL_RGB, GL_UNSIGNED_BYTE, chain.pixels(level));
+        glFinish();
+        cpuBest = std::min(cpuBest, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        smallestTexel(cpuLevels, cpuTexel);
+
+        start = Clock::now();
+        gpuLevels = 1 + (int)std::floor(std::log2((double)std::max(width, height)));
+        GLTexture gpu = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D, gpu);
+        glTexStorage2D(GL_TEXTURE_2D, gpuLevels, GL_RGB8, width, height);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, image);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFinish();
+        gpuBest = std::min(gpuBest, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        smallestTexel(gpuLevels, gpuTexel);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    double mean[3] = {};
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+        for (int k = 0; k < 3; ++k)
+            mean[k] += image[i * 3 + k];
+    stbi_image_free(image);
+    double cpuError = 0.0, gpuError = 0.0;
+    for (int k = 0; k < 3; ++k)
+    {
+        mean[k] /= (double)width * height;
+        cpuError = std::max(cpuError, std::fabs(cpuTexel[k] - mean[k]));
+        gpuError = std::max(gpuError, std::fabs(gpuTexel[k] - mean[k]));
+    }
+    printf("mips of container.jpg: MipChain %.2f ms, glGenerateMipmap %.2f ms; last level off the mean by %.1f and %.1f\n",
+           cpuBest, gpuBest, cpuError, gpuError);
+    check(cpuLevels == gpuLevels && cpuError <= 1.0, "MipChain's last level is the image's mean");
+    GLDeletionQueue::shared().flush();
+    check(glGetError() == GL_NO_ERROR, "mip timing GL errors");
+}
+
+// the box's stages as a separable pipeline, drawing a texture array layer
+// the same as the linked program would, and a stage whose inputs the vertex
+// stage doesn't write refused
+void checkShaderPipeline()
+{
+    if (!ShaderStages::supported())
+    {
+        printf("no separate shader objects, pipeline checks skipped\n");
+        return;
+    }
+    ShaderStages stages;
+    Shader &vertex = stages.stage(GL_VERTEX_SHADER, "6.2.coordinate_systems.vs");
+    Shader &fragment = stages.stage(GL_FRAGMENT_SHADER, "6.2.coordinate_systems.fs");
+    ShaderPipeline &pipeline = stages.pipeline(vertex, fragment);
+    check(pipeline.valid(), "box pipeline valid");
+    check(&stages.pipeline(vertex, fragment) == &pipeline && stages.stats().pipelines == 1, "pipeline made once");
+
+    {
+        std::ofstream mismatch("checks_mismatch.fs");
+        mismatch << "#version 330 core\nout vec4 FragColor;\nin vec3 TexCoord;\n"
+                    "void main()\n{\n\tFragColor = vec4(TexCoord, 1.0);\n}\n";
+    }
+    Shader &wrongType = stages.stage(GL_FRAGMENT_SHADER, "checks_mismatch.fs");
+    check(!stages.pipeline(vertex, wrongType).valid(), "pipeline with mismatched interface refused");
+    std::remove("checks_mismatch.fs");
+
+    const unsigned char texel[4] = { 200, 100, 50, 255 };
+    GLTexture array = GLTexture::create();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, 1, 1, 1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindSampler(0, 0);
+
+    vertex.bindBlock("Frame", 0);
+    vertex.bindBlock("Draw", 1);
+    GLBuffer frameBlock, drawBlock, vertices;
+    GLVertexArray vertexArray;
+    GLTexture target;
+    GLFramebuffer framebuffer;
+    identityTransforms(frameBlock, drawBlock);
+    screenQuad(vertexArray, vertices);
+    renderTarget(target, framebuffer, 4, 4);
+
+    pipeline.use();
+    Shader &uniforms = pipeline.uniforms(fragment);
+    uniforms.setInt("textures", 0);
+    uniforms.setVec3("layer1", 1.0f, 1.0f, 0.0f);
+    uniforms.setVec3("layer2", 1.0f, 1.0f, 0.0f);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    unsigned char pixel[4] = { 0, 0, 0, 0 };
+    glReadPixels(1, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+    check(std::memcmp(pixel, texel, 4) == 0, "pipeline draws the texture layer");
+
+    glBindProgramPipeline(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    GLDeletionQueue::shared().flush();
+    check(glGetError() == GL_NO_ERROR, "shader pipeline GL errors");
+}
+
+// a linked program of a vertex stage reading projection and fragment
+std::unique_ptr<Shader> uniformProgram(const std::string &fragment)
+{
+    const std::string vertex = "#version 330 core\nlayout (location = 0) in vec3 aPos;\nuniform mat4 projection;\n"
+                               "void main()\n{\n\tgl_Position = projection * vec4(aPos, 1.0);\n}\n";
+    std::unique_ptr<Shader> shader(new Shader(Shader::Source(), vertex, fragment));
+    shader->finish();
+    return shader;
+}
+
+// the hashed setters upload without allocating, and names that hash alike
+// are reported rather than mixed up
+void checkUniformSetters()
+{
+    static_assert(uniformHash("cS3zSenwQ", 9) == uniformHash("lAh6Iyn", 7), "the names below hash alike");
+    std::unique_ptr<Shader> shader(uniformProgram("#version 330 core\nout vec4 FragColor;\nuniform float cS3zSenwQ;\n"
+                                                  "void main()\n{\n\tFragColor = vec4(cS3zSenwQ);\n}\n"));
+    shader->use();
+    glm::mat4 projection(1.0f);
+    unsigned int issued = shader->uniformCounters().issued;
+    size_t before = allocations;
+    for (int i = 0; i < 10000; ++i)
+    {
+        projection[3][0] = (float)i;
+        shader->setMat4("projection"_u, projection);
+    }
+    check(allocations == before, "hashed setters don't allocate");
+    check(shader->uniformCounters().issued - issued == 10000, "hashed setters upload every change");
+
+    std::ostringstream report;
+    std::streambuf *out = std::cout.rdbuf(report.rdbuf());
+    std::unique_ptr<Shader> both(uniformProgram("#version 330 core\nout vec4 FragColor;\nuniform float cS3zSenwQ;\nuniform float lAh6Iyn;\n"
+                                                "void main()\n{\n\tFragColor = vec4(cS3zSenwQ, lAh6Iyn, 0.0, 1.0);\n}\n"));
+    std::cout.rdbuf(out);
+    check(report.str().find("UNIFORM_HASH_COLLISION: ") != std::string::npos, "colliding names in a program reported");
+
+#ifndef NDEBUG
+    // the names are only kept to compare in debug builds
+    report.str("");
+    out = std::cout.rdbuf(report.rdbuf());
+    shader->use();
+    shader->setFloat("lAh6Iyn"_u, 1.0f);
+    std::cout.rdbuf(out);
+    GLfloat value = -1.0f;
+    glGetUniformfv(shader->ID, shader->location("cS3zSenwQ"_u), &value);
+    check(report.str().find("UNIFORM_HASH_COLLISION: lAh6Iyn and cS3zSenwQ") != std::string::npos && value == 0.0f,
+          "a name hashing like the program's uniform reported, not set");
+#endif
+    glUseProgram(0);
+    GLDeletionQueue::shared().flush();
+    check(glGetError() == GL_NO_ERROR, "uniform setter GL errors");
+}
+
+int main(int argc, char *argv[])
+{
+    if (!setupcontext())
+    {
+        std::cout << "ERROR::CHECKS::NO_CONTEXT" << std::endl;
+        return 1;
+    }
+    printf("%s, %s\n", glGetString(GL_VERSION), glGetString(GL_RENDERER));
+
+    checkTextureBudget();
+    checkVirtualTexture();
+    checkShaderPipeline();
+    checkUniformSetters();
+    checkMipChainTiming();
+
+    printf("%s\n", failures ? "checks failed" : "checks passed");
+    return failures ? 1 : 0;
+}
@@ -10,6 +10,15 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 #include "Shader.h"
+#include "TextureManager.h"
+#include "TextureArray.h"
+#include "VirtualTexture.h"
+#include "UniformRing.h"
+#include "ShaderCompiler.h"
+#include "ShaderVariants.h"
+#include "ShaderReloader.h"
+#include "GLHandle.h"
+#include <memory>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -20,6 +29,23 @@
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+// uniform block binding points, and the std140 layout of the blocks in
+// 6.2.coordinate_systems.vs (a mat4 is four vec4 columns, as in glm)
+const unsigned int FRAME_BLOCK = 0;
+const unsigned int DRAW_BLOCK = 1;
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    float time;
+    float padding[3];
+};
+struct DrawUniforms
+{
+    glm::mat4 model;
+};
+
 
 /* A simple function that prints a message, the error code returned by SDL, and quits the application */
 void sdldie(const char *msg)
@@ -96,6 +122,9 @@ void setupwindow(SDL_Window* & window, SDL_GLContext & context)
 
 void quit_program( int code )
 {
+    // exit() skips the end of main, so delete what's been retired while
+    // the context is still there
+    GLDeletionQueue::shared().flush();
     SDL_Quit( );
     exit( code );
 }
@@ -143,8 +172,8 @@ void destroywindow(SDL_Window* & window, SDL_GLContext & context)
     SDL_Quit();
 }
 
-/* Our program's entry point */
-int main()
+/* Our program's entry point; pass a paged file from Tiler to texture the box with it */
+int main(int argc, char *argv[])
 {
     SDL_Window* mainwindow; /* Our window handle */
     SDL_GLContext maincontext; /* Our opengl context handle */
@@ -154,7 +183,31 @@ int main()
 
     glEnable(GL_DEPTH_TEST);  
 
-    Shader ourShader("6.2.coordinate_systems.vs", "6.2.coordinate_systems.fs");
+    // start every program compiling now and collect them once the textures
+    // are loaded. drivers that can't compile in the background by themselves
+    // get a worker thread with a context of its own.
+    // the worker's context gets a hidden window of its own, since EGL won't
+    // make the main window current on two threads at once
+    SDL_Window *compileWindow = nullptr;
+    SDL_GLContext compileContext = nullptr;
+    if (!ShaderCompiler::parallelSupported())
+    {
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        compileWindow = SDL_CreateWindow(PROGRAM_NAME, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1,
+                                         SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+        if (compileWindow)
+            compileContext = SDL_GL_CreateContext(compileWindow);
+        SDL_GL_MakeCurrent(mainwindow, maincontext);
+    }
+    ShaderCompiler compiler(compileContext ? std::function<bool()>([&] { return SDL_GL_MakeCurrent(compileWindow, compileContext) == 0; })
+                                           : std::function<bool()>());
+    ShaderFuture ourProgram = compiler.compile("6.2.coordinate_systems.vs", "6.2.coordinate_systems.fs");
+    // the virtual texture's sampling and feedback passes are variants of one
+    // source, kept as program binaries between runs and compiled alongside
+    ShaderVariants virtualShaders("6.2.coordinate_systems.vs", "virtual_texture.fs", { "VT_FEEDBACK" }, "shader_cache");
+    virtualShaders.setCompiler(&compiler);
+    const uint32_t VT_FEEDBACK = virtualShaders.bit("VT_FEEDBACK");
+    virtualShaders.prewarm({ 0, VT_FEEDBACK });
 
     // build and compile our shader program
     // ------------------------------------
@@ -206,79 +259,117 @@ int main()
         -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
         -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
     };
-    unsigned int VAO, VBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
+    GLVertexArray VAO = GLVertexArray::create();
+    GLBuffer VBO = GLBuffer::create();
 
     glBindVertexArray(VAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // texture coord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    // position and texture coord attributes, pointed at wherever the program
+    // reads them once it's linked
+    const VertexAttribute boxLayout[] = {
+        { "aPos", 3, GL_FLOAT, 0 },
+        { "aTexCoord", 2, GL_FLOAT, 3 * sizeof(float) },
+    };
 
 
-    // load and create a texture
+    // load and create textures
     // -------------------------
-    unsigned int texture1, texture2;
-    // texture 1
-    // ---------
-    glGenTextures(1, &texture1);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    int width, height, nrChannels;
+    // decoded and compressed layers are kept on disk, so later runs skip the work
+    TextureCache cache;
+    TextureManager textures;
+    textures.setCache(&cache);
+    TextureArrayPacker packer;
+    packer.setCache(&cache);
+    // store both textures as ETC2, which GLES 3.0 hardware samples natively
+    packer.setCompression(true);
     stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    unsigned char *data = stbi_load("container.jpg", &width, &height, &nrChannels, 0);
-    if (data)
+    int container = packer.add("container.jpg");
+    // awesomeface.png is 476x476 with alpha; resizing it lets it share container.jpg's
+    // array, which gets an ETC2 + EAC alpha format
+    int face = packer.add("awesomeface.png", ArrayFit::Resize);
+    packer.build();
+    const Etc2Encoder::Stats &etc2 = packer.compressionStats();
+    if (etc2.pixels)
+        printf("Compressed textures to ETC2: %.2f dB PSNR, %.1f Mpixels/s.\n", etc2.psnr(), etc2.megapixelsPerSecond());
+    printf("Texture cache: %d hits, %d misses.\n", cache.stats().hits, cache.stats().misses);
+    const ArrayLayer &layer1 = packer.layer(container);
+    const ArrayLayer &layer2 = packer.layer(face);
+    // both textures repeat and are trilinearly filtered, so they share one sampler
+    unsigned int sampler = textures.sampler();
+
+    // tell opengl for each sampler to which texture unit it belongs to, and which layers
+    // the materials use (only has to be done once)
+    // -------------------------------------------------------------------------------------------
+    Shader &ourShader = ourProgram.get();
+    ourShader.use();
+    ourShader.setInt("textures"_u, 0);
+    ourShader.setVec3("layer1"_u, layer1.scaleS, layer1.scaleT, (float)layer1.layer);
+    ourShader.setVec3("layer2"_u, layer2.scaleS, layer2.scaleT, (float)layer2.layer);
+
+    // an image too big to load whole is streamed in tiles instead, as the box needs them
+    std::unique_ptr<VirtualTexture> virtualTexture;
+    Shader &virtualShader = virtualShaders.get(0);
+    Shader &feedbackShader = virtualShaders.get(VT_FEEDBACK);
+    if (argc > 1)
+    {
+        virtualTexture.reset(new VirtualTexture(argv[1]));
+        if (!virtualTexture->valid())
+            virtualTexture.reset();
+    }
+    if (virtualTexture)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        virtualShader.use();
+        virtualShader.setInt("vtCache"_u, 0);
+        virtualShader.setInt("vtIndirection"_u, 1);
+        virtualTexture->setUniforms(virtualShader);
+        feedbackShader.use();
+        virtualTexture->setUniforms(feedbackShader);
+        feedbackShader.setFloat("vtLodBias"_u, virtualTexture->feedbackLodBias(SCR_WIDTH, SCR_HEIGHT));
     }
-    else
+
+    // the matrices come from uniform blocks, written once a frame into a ring
+    // buffer; every program reads them from the same binding points
+    UniformRing ring;
+    Shader *shaders[] = { &ourShader, &virtualShader, &feedbackShader };
+    for (Shader *shader : shaders)
     {
-        std::cout << "Failed to load texture" << std::endl;
+        shader->bindBlock("Frame", FRAME_BLOCK);
+        shader->bindBlock("Draw", DRAW_BLOCK);
+        // the structs have to lay the blocks out as std140 does
+        const ShaderReflection::Block *frameBlock = shader->reflection().block("Frame");
+        const ShaderReflection::Block *drawBlock = shader->reflection().block("Draw");
+        if ((frameBlock && frameBlock->size != (GLint)sizeof(FrameUniforms)) || (drawBlock && drawBlock->size != (GLint)sizeof(DrawUniforms)))
+            std::cout << "ERROR::CUBE::UNIFORM_BLOCK_SIZE_MISMATCH" << std::endl;
     }
-    stbi_image_free(data);
-    // texture 2
-    // ---------
-    glGenTextures(1, &texture2);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    data = stbi_load("awesomeface.png", &width, &height, &nrChannels, 0);
-    if (data)
+
+    // every program shares the vertex shader, so one set of locations does
+    std::vector<GLint> boxLocations = ourShader.reflection().locations(boxLayout);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    for (size_t i = 0; i < boxLocations.size(); ++i)
     {
-        // note that the awesomeface.png has transparency and thus an alpha channel, so make sure to tell OpenGL the data type is of GL_RGBA
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        if (boxLocations[i] < 0)
+            continue;
+        glVertexAttribPointer(boxLocations[i], boxLayout[i].components, boxLayout[i].type, GL_FALSE, 5 * sizeof(float),
+                              (void*)boxLayout[i].offset);
+        glEnableVertexAttribArray(boxLocations[i]);
     }
-    else
+
+    // SHADER_REFLECTION=<directory> writes what every program reads there as
+    // JSON, for tools
+    if (const char *directory = getenv("SHADER_REFLECTION"))
     {
-        std::cout << "Failed to load texture" << std::endl;
+        const char *names[] = { "box", "virtual_texture", "virtual_texture_feedback" };
+        for (size_t i = 0; i < sizeof(shaders) / sizeof(shaders[0]); ++i)
+            ShaderReflection(shaders[i]->ID).save(std::string(directory) + "/" + names[i] + ".json");
     }
-    stbi_image_free(data);
 
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    // -------------------------------------------------------------------------------------------
-    ourShader.use();
-    ourShader.setInt("texture1", 0);
-    ourShader.setInt("texture2", 1);
+    // edits to the shaders show up without restarting
+    ShaderReloader reloader(compiler);
+    reloader.watch(ourShader, "6.2.coordinate_systems.vs", "6.2.coordinate_systems.fs");
+    virtualShaders.watch(reloader);
 
 
 
@@ -287,21 +378,13 @@ int main()
       // input
       // -----
       process_events();
+      reloader.update();
 
       // render
       // ------
       glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // also clear the depth buffer now!
 
-      // bind textures on corresponding texture units
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, texture1);
-      glActiveTexture(GL_TEXTURE1);
-      glBindTexture(GL_TEXTURE_2D, texture2);
-
-      // activate shader
-      ourShader.use();
-
       // create transformations
       glm::mat4 model         = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
       glm::mat4 view          = glm::mat4(1.0f);
@@ -309,23 +392,59 @@ int main()
       model = glm::rotate(model, float(SDL_GetTicks() * 0.001), glm::vec3(0.5f, 1.0f, 0.0f));
       view  = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
       projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-      // retrieve the matrix uniform locations
-      unsigned int modelLoc = glGetUniformLocation(ourShader.ID, "model");
-      unsigned int viewLoc  = glGetUniformLocation(ourShader.ID, "view");
-      // pass them to the shaders (3 different ways)
-      glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-      glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-      // note: currently we set the projection matrix each frame, but since the projection matrix rarely changes it's often best practice to set it outside the main loop only once.
-      ourShader.setMat4("projection", projection);
-
-      // render box
+
+      // one mapping of the ring holds the frame's blocks and the box's
+      ring.begin();
+      FrameUniforms frame;
+      frame.view = view;
+      frame.projection = projection;
+      frame.viewProjection = projection * view;
+      frame.time = SDL_GetTicks() * 0.001f;
+      GLintptr frameOffset = ring.push(frame);
+      DrawUniforms box;
+      box.model = model;
+      GLintptr boxOffset = ring.push(box);
+      ring.end();
+      ring.bind<FrameUniforms>(FRAME_BLOCK, frameOffset);
+      ring.bind<DrawUniforms>(DRAW_BLOCK, boxOffset);
+
       glBindVertexArray(VAO);
-      glDrawArrays(GL_TRIANGLES, 0, 36);
+      if (virtualTexture)
+      {
+          // load what the last frame's feedback asked for, then record what this one needs
+          virtualTexture->update();
+          virtualTexture->bind(0, 1);
+          feedbackShader.use();
+          virtualTexture->beginFeedback();
+          glDrawArrays(GL_TRIANGLES, 0, 36);
+          virtualTexture->endFeedback();
+          virtualShader.use();
+          glDrawArrays(GL_TRIANGLES, 0, 36);
+      }
+      else
+      {
+          // one bind covers both materials
+          packer.bind(0, layer1.array, sampler);
+
+          // activate shader
+          ourShader.use();
+
+          // render box
+          glDrawArrays(GL_TRIANGLES, 0, 36);
+      }
+      // the GPU is done with this part of the ring once these draws are
+      ring.fence();
+      // and then with whatever was retired during the frame
+      GLDeletionQueue::shared().frame();
 
 
       SDL_GL_SwapWindow( mainwindow );
     }
 
+    if (compileContext)
+        SDL_GL_DeleteContext(compileContext);
+    if (compileWindow)
+        SDL_DestroyWindow(compileWindow);
     /* Delete our opengl context, destroy our window, and shutdown SDL */
     destroywindow(mainwindow, maincontext);
 
@@ -334,7 +334,8 @@ RECENT REVISION HISTORY:
 //    valid image of gigantic dimensions and force stb_image to allocate a
 //    huge block of memory and spend disproportionate time decoding it. By
 //    default this is set to (1 << 24), which is 16777216, but that's still
-//    very big.
+//    very big. stbi_set_limits() sets tighter bounds at runtime, including
+//    a cap on the memory a single load may hold at once.
 
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
@@ -402,6 +403,18 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+#if !defined(STBI_NO_PNM) && !defined(STBI_NO_STDIO)
+// map a binary 8-bit PGM (P5) or PPM (P6) file and return a pointer straight
+// into the mapping, with nothing decoded or copied, so PNM can serve as a
+// raw-pixel cache format. the pixels are read-only. *mapping receives the
+// handle to pass to stbi_pnm_unmap (not stbi_image_free). if the file can't
+// be used in place (no mmap on this platform, not 8-bit PNM, desired_channels
+// differs, or flip-on-load is set) this falls back to stbi_load behind the
+// same handle.
+STBIDEF stbi_uc const *stbi_pnm_map  (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, void **mapping);
+STBIDEF void           stbi_pnm_unmap(void *mapping);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -419,6 +432,24 @@ STBIDEF stbi_us *stbi_load_16          (char const *filename, int *x, int *y, in
 STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
 #endif
 
+////////////////////////////////////
+//
+// half-float interface
+//
+// returns IEEE 754 binary16 samples, ready to upload as GL_HALF_FLOAT (e.g. to
+// an RGBA16F texture). HDR files give the same linear values stbi_loadf does.
+// every other format gives what stbi_load_16 would, divided by 65535: samples
+// normalized to [0,1] at full decoded precision (16-bit PNG, PSD and PNM keep
+// all 16 bits), with no stbi_ldr_to_hdr_gamma applied.
+
+STBIDEF stbi_us *stbi_loadh_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF stbi_us *stbi_loadh_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels);
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_us *stbi_loadh          (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF stbi_us *stbi_loadh_from_file(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
 ////////////////////////////////////
 //
 // float-per-channel interface
@@ -491,6 +522,36 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// whether loads on the calling thread are flipped, for code that caches decoded images
+STBIDEF int stbi_get_flip_vertically_on_load(void);
+
+// runtime load limits, on top of the compile-time STBI_MAX_DIMENSIONS. a field
+// left at zero is unlimited. dimensions are checked as soon as the header has
+// been parsed, before any image-sized allocation; max_alloc_bytes bounds the
+// most memory one call (a load, stbi_info, a zlib decode...) holds at once,
+// its scratch buffers plus the image it's building, with the budget starting
+// afresh at every call. a call that exceeds a limit fails with
+// stbi_failure_reason() "limits exceeded".
+//
+// the limits are set the way flip-on-load is, rather than passed to every
+// load function: to give each decode its own limits, set them with
+// stbi_set_limits_thread() on the decoding thread right before the call.
+typedef struct
+{
+   int    max_width;
+   int    max_height;
+   size_t max_pixels;
+   size_t max_alloc_bytes;
+} stbi_limits;
+
+// pass NULL to remove all limits
+STBIDEF void stbi_set_limits(stbi_limits const *limits);
+
+// as above, but only applies to images loaded on the thread that calls the function;
+// NULL reverts the thread to the global limits. same availability as
+// stbi_set_flip_vertically_on_load_thread
+STBIDEF void stbi_set_limits_thread(stbi_limits const *limits);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -785,6 +846,7 @@ typedef struct
 
 
 static void stbi__refill_buffer(stbi__context *s);
+static void stbi__begin_load(void);
 
 // initialize a memory-decode context
 static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
@@ -794,6 +856,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   stbi__begin_load();
 }
 
 // initialize a callback-based context
@@ -807,6 +870,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   stbi__begin_load();
 }
 
 #ifndef STBI_NO_STDIO
@@ -867,6 +931,7 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int flipped; // loader already applied stbi__vertically_flip_on_load
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -877,7 +942,7 @@ static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
 
 #ifndef STBI_NO_PNG
 static int      stbi__png_test(stbi__context *s);
-static void    *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
+static void    *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc);
 static int      stbi__png_info(stbi__context *s, int *x, int *y, int *comp);
 static int      stbi__png_is16(stbi__context *s);
 #endif
@@ -926,6 +991,8 @@ static void    *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
+static int      stbi__info_main(stbi__context *s, int *x, int *y, int *comp);
+
 static
 #ifdef STBI_THREAD_LOCAL
 STBI_THREAD_LOCAL
@@ -945,9 +1012,154 @@ static int stbi__err(const char *str)
 }
 #endif
 
+static stbi_limits stbi__limits_global;
+
+STBIDEF void stbi_set_limits(stbi_limits const *limits)
+{
+   if (limits) stbi__limits_global = *limits;
+   else memset(&stbi__limits_global, 0, sizeof(stbi__limits_global));
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__limits  stbi__limits_global
+#else
+static STBI_THREAD_LOCAL stbi_limits stbi__limits_local;
+static STBI_THREAD_LOCAL int stbi__limits_set;
+
+STBIDEF void stbi_set_limits_thread(stbi_limits const *limits)
+{
+   if (limits) stbi__limits_local = *limits;
+   stbi__limits_set = limits != NULL;
+}
+
+#define stbi__limits  (stbi__limits_set ? stbi__limits_local : stbi__limits_global)
+#endif // STBI_THREAD_LOCAL
+
+// the bytes held by the call in progress on this thread, and whether it has
+// run into a limit. while max_alloc_bytes is set, every allocation is kept in
+// a small table so that freeing it gives its bytes back, which makes the
+// budget a cap on the most the call holds at once rather than on everything
+// it ever allocated. an allocation that doesn't fit in the table is charged
+// but never given back, which only makes the budget stricter. the allocator
+// can't set the failure reason itself, since its callers report "outofmem";
+// stbi__limit_result fixes that up on the way out.
+#define STBI__MAX_TRACKED_ALLOCS  64
+
+typedef struct
+{
+   void  *p;
+   size_t size;
+} stbi__tracked_alloc;
+
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+stbi__tracked_alloc stbi__allocs[STBI__MAX_TRACKED_ALLOCS];
+
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+int stbi__alloc_count;
+
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+size_t stbi__alloc_live;
+
+static
+#ifdef STBI_THREAD_LOCAL
+STBI_THREAD_LOCAL
+#endif
+int stbi__limit_hit;
+
+// called at every public entry point, so no call inherits another's budget
+static void stbi__begin_load(void)
+{
+   stbi__alloc_count = 0;
+   stbi__alloc_live = 0;
+   stbi__limit_hit = 0;
+}
+
+static int stbi__charge_alloc(size_t size)
+{
+   size_t budget = stbi__limits.max_alloc_bytes;
+   if (budget && (size > budget || stbi__alloc_live > budget - size)) {
+      stbi__limit_hit = 1;
+      return 0;
+   }
+   stbi__alloc_live += size;
+   return 1;
+}
+
+static void stbi__credit_alloc(size_t size)
+{
+   stbi__alloc_live -= size < stbi__alloc_live ? size : stbi__alloc_live;
+}
+
+static void stbi__track_alloc(void *p, size_t size)
+{
+   if (stbi__alloc_count < STBI__MAX_TRACKED_ALLOCS) {
+      stbi__allocs[stbi__alloc_count].p = p;
+      stbi__allocs[stbi__alloc_count].size = size;
+      ++stbi__alloc_count;
+   }
+}
+
+// removes p from the table and returns its size, or untracked if it isn't there
+static size_t stbi__untrack_alloc(void *p, size_t untracked)
+{
+   int i;
+   // newest first, since scratch tends to be freed in reverse order
+   for (i = stbi__alloc_count - 1; i >= 0; --i) {
+      if (stbi__allocs[i].p == p) {
+         size_t size = stbi__allocs[i].size;
+         stbi__allocs[i] = stbi__allocs[--stbi__alloc_count];
+         return size;
+      }
+   }
+   return untracked;
+}
+
 static void *stbi__malloc(size_t size)
 {
-    return STBI_MALLOC(size);
+   void *p;
+   if (!stbi__limits.max_alloc_bytes) return STBI_MALLOC(size);
+   if (!stbi__charge_alloc(size)) return NULL;
+   p = STBI_MALLOC(size);
+   if (p) stbi__track_alloc(p, size);
+   else stbi__credit_alloc(size);
+   return p;
+}
+
+static void *stbi__realloc_sized(void *p, size_t oldsz, size_t newsz)
+{
+   size_t held;
+   void *q;
+   if (!stbi__limits.max_alloc_bytes) return STBI_REALLOC_SIZED(p, oldsz, newsz);
+   held = p ? stbi__untrack_alloc(p, oldsz) : 0;
+   if (newsz > held && !stbi__charge_alloc(newsz - held)) {
+      if (p) stbi__track_alloc(p, held);
+      return NULL;
+   }
+   q = STBI_REALLOC_SIZED(p, oldsz, newsz);
+   if (q == NULL) {
+      // p is still there, and still held
+      if (newsz > held) stbi__credit_alloc(newsz - held);
+      if (p) stbi__track_alloc(p, held);
+      return NULL;
+   }
+   if (newsz < held) stbi__credit_alloc(held - newsz);
+   stbi__track_alloc(q, newsz);
+   return q;
+}
+
+static void stbi__free(void *p)
+{
+   if (p) stbi__credit_alloc(stbi__untrack_alloc(p, 0));
+   STBI_FREE(p);
 }
 
 // stb_image uses ints pervasively, including for offset calculations.
@@ -1044,6 +1256,28 @@ static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 #define stbi__errpf(x,y)   ((float *)(size_t) (stbi__err(x,y)?NULL:NULL))
 #define stbi__errpuc(x,y)  ((unsigned char *)(size_t) (stbi__err(x,y)?NULL:NULL))
 
+// a load that failed because it ran into max_alloc_bytes reports that, rather
+// than the "outofmem" set where the allocation failed
+static void *stbi__limit_result(void *result)
+{
+   if (result == NULL && stbi__limit_hit)
+      return stbi__errpuc("limits exceeded", "Image exceeds load limits");
+   return result;
+}
+
+// returns 1 if a w x h image fits the runtime limits; otherwise sets the failure reason
+static int stbi__within_limits(int w, int h)
+{
+   stbi_limits limits = stbi__limits;
+   if ((limits.max_width  && w > limits.max_width) ||
+       (limits.max_height && h > limits.max_height) ||
+       (limits.max_pixels && (double) w * (double) h > (double) limits.max_pixels)) {
+      stbi__limit_hit = 1;
+      return stbi__err("limits exceeded", "Image exceeds load limits");
+   }
+   return 1;
+}
+
 STBIDEF void stbi_image_free(void *retval_from_stbi_load)
 {
    STBI_FREE(retval_from_stbi_load);
@@ -1055,6 +1289,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
 
 #ifndef STBI_NO_HDR
 static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
+static stbi__uint16 *stbi__hdr_to_ldr16(float *data, int x, int y, int comp);
 #endif
 
 static int stbi__vertically_flip_on_load_global = 0;
@@ -1080,6 +1315,26 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+STBIDEF int stbi_get_flip_vertically_on_load(void)
+{
+   return stbi__vertically_flip_on_load;
+}
+
+// with dimension limits set and the whole file in memory, reject an oversized
+// image from its header before any decoder state is allocated. other sources
+// can't be rewound that far, so they rely on the check each loader makes as
+// soon as it has parsed the header.
+static int stbi__preflight_limits(stbi__context *s)
+{
+   stbi_limits limits = stbi__limits;
+   int x, y, comp, ok;
+   if (s->io.read || !(limits.max_width || limits.max_height || limits.max_pixels))
+      return 1;
+   ok = stbi__info_main(s, &x, &y, &comp);
+   stbi__rewind(s);
+   return !ok || stbi__within_limits(x, y);
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1087,11 +1342,13 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    ri->channel_order = STBI_ORDER_RGB; // all current input & output are this, but this is here so we can add BGR order
    ri->num_channels = 0;
 
+   if (!stbi__preflight_limits(s)) return NULL;
+
    #ifndef STBI_NO_JPEG
    if (stbi__jpeg_test(s)) return stbi__jpeg_load(s,x,y,comp,req_comp, ri);
    #endif
    #ifndef STBI_NO_PNG
-   if (stbi__png_test(s))  return stbi__png_load(s,x,y,comp,req_comp, ri);
+   if (stbi__png_test(s))  return stbi__png_load(s,x,y,comp,req_comp, ri, bpc);
    #endif
    #ifndef STBI_NO_BMP
    if (stbi__bmp_test(s))  return stbi__bmp_load(s,x,y,comp,req_comp, ri);
@@ -1114,6 +1371,10 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    #ifndef STBI_NO_HDR
    if (stbi__hdr_test(s)) {
       float *hdr = stbi__hdr_load(s, x,y,comp,req_comp, ri);
+      if (bpc == 16) {
+         ri->bits_per_channel = 16;
+         return stbi__hdr_to_ldr16(hdr, *x, *y, req_comp ? req_comp : *comp);
+      }
       return stbi__hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp);
    }
    #endif
@@ -1134,12 +1395,12 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    stbi_uc *reduced;
 
    reduced = (stbi_uc *) stbi__malloc(img_len);
-   if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
+   if (reduced == NULL) { stbi__free(orig); return stbi__errpuc("outofmem", "Out of memory"); }
 
    for (i = 0; i < img_len; ++i)
       reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return reduced;
 }
 
@@ -1150,12 +1411,12 @@ static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int chan
    stbi__uint16 *enlarged;
 
    enlarged = (stbi__uint16 *) stbi__malloc(img_len*2);
-   if (enlarged == NULL) return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
+   if (enlarged == NULL) { stbi__free(orig); return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory"); }
 
    for (i = 0; i < img_len; ++i)
       enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
 
-   STBI_FREE(orig);
+   stbi__free(orig);
    return enlarged;
 }
 
@@ -1183,6 +1444,20 @@ static void stbi__vertical_flip(void *image, int w, int h, int bytes_per_pixel)
    }
 }
 
+#if !defined(STBI_NO_TGA) || !defined(STBI_NO_PIC)
+// replicate the pixel at p across a run of count pixels, doubling the copy
+// each time so long runs go out as a handful of wide memcpys
+static void stbi__fill_run(stbi_uc *p, int count, int bytes_per_pixel)
+{
+   size_t have = bytes_per_pixel, total = (size_t) count * bytes_per_pixel;
+   while (have < total) {
+      size_t n = have < total - have ? have : total - have;
+      memcpy(p + have, p, n);
+      have += n;
+   }
+}
+#endif
+
 #ifndef STBI_NO_GIF
 static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int bytes_per_pixel)
 {
@@ -1203,7 +1478,7 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
    void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
 
    if (result == NULL)
-      return NULL;
+      return (unsigned char *) stbi__limit_result(NULL);
 
    // it is the responsibility of the loaders to make sure we get either 8 or 16 bit.
    STBI_ASSERT(ri.bits_per_channel == 8 || ri.bits_per_channel == 16);
@@ -1211,11 +1486,13 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
    if (ri.bits_per_channel != 8) {
       result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
       ri.bits_per_channel = 8;
+      if (result == NULL)
+         return (unsigned char *) stbi__limit_result(NULL);
    }
 
    // @TODO: move stbi__convert_format to here
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load && !ri.flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
    }
@@ -1229,7 +1506,7 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
    void *result = stbi__load_main(s, x, y, comp, req_comp, &ri, 16);
 
    if (result == NULL)
-      return NULL;
+      return (stbi__uint16 *) stbi__limit_result(NULL);
 
    // it is the responsibility of the loaders to make sure we get either 8 or 16 bit.
    STBI_ASSERT(ri.bits_per_channel == 8 || ri.bits_per_channel == 16);
@@ -1237,12 +1514,14 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
    if (ri.bits_per_channel != 16) {
       result = stbi__convert_8_to_16((stbi_uc *) result, *x, *y, req_comp == 0 ? *comp : req_comp);
       ri.bits_per_channel = 16;
+      if (result == NULL)
+         return (stbi__uint16 *) stbi__limit_result(NULL);
    }
 
    // @TODO: move stbi__convert_format16 to here
    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load && !ri.flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
    }
@@ -1260,6 +1539,123 @@ static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, in
 }
 #endif
 
+// float to IEEE half, round to nearest even; overflow goes to infinity and
+// NaNs stay NaN. this is the bit-twiddling version from Fabian Giesen's
+// half conversion notes, so the scalar and SIMD paths agree bit for bit.
+static stbi__uint16 stbi__float_to_half(float f)
+{
+   union { stbi__uint32 u; float f; } v, denorm_magic;
+   stbi__uint32 sign, o;
+   denorm_magic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+   v.f = f;
+   sign = v.u & 0x80000000u;
+   v.u ^= sign;
+   if (v.u >= ((127 + 16) << 23)) {          // overflow, inf or NaN
+      o = v.u > (255u << 23) ? 0x7e00 : 0x7c00;
+   } else if (v.u < ((127 - 14) << 23)) {    // zero or subnormal: let the FPU round
+      v.f += denorm_magic.f;
+      o = v.u - denorm_magic.u;
+   } else {
+      stbi__uint32 mant_odd = (v.u >> 13) & 1;
+      v.u += ((stbi__uint32) (15 - 127) << 23) + 0xfff;
+      v.u += mant_odd;
+      o = v.u >> 13;
+   }
+   return (stbi__uint16) (o | (sign >> 16));
+}
+
+#ifdef STBI_SSE2
+static __m128i stbi__float_to_half_sse2(__m128 f)
+{
+   __m128i subnorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+   __m128  justsign   = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32((int) 0x80000000u)));
+   __m128  absf       = _mm_xor_ps(f, justsign);
+   __m128i absi       = _mm_castps_si128(absf);
+   __m128i is_regular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), absi);
+   __m128i is_sub     = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), absi);
+   __m128i nanbit     = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), _mm_set1_epi32(0x200));
+   __m128i special    = _mm_or_si128(nanbit, _mm_set1_epi32(0x7c00));
+   __m128i subnorm    = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subnorm_magic))), subnorm_magic);
+   __m128i mant_odd   = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31);
+   __m128i normal     = _mm_add_epi32(absi, _mm_set1_epi32(0xfff - ((127 - 15) << 23)));
+   __m128i finite, joined;
+   normal = _mm_srli_epi32(_mm_sub_epi32(normal, mant_odd), 13);
+   finite = _mm_or_si128(_mm_and_si128(is_sub, subnorm), _mm_andnot_si128(is_sub, normal));
+   joined = _mm_or_si128(_mm_and_si128(is_regular, finite), _mm_andnot_si128(is_regular, special));
+   // the sign lands in bits 15..31, which keeps packs_epi32 from saturating
+   return _mm_or_si128(joined, _mm_srai_epi32(_mm_castps_si128(justsign), 16));
+}
+#endif
+
+// convert n floats to halves. out may alias in, since each output is written
+// no later than its input has been read.
+static void stbi__float_to_half_run(stbi__uint16 *out, float const *in, int n)
+{
+   int i = 0;
+#ifdef STBI_SSE2
+   if (stbi__sse2_available()) {
+      for (; i+7 < n; i += 8) {
+         __m128i lo = stbi__float_to_half_sse2(_mm_loadu_ps(in + i));
+         __m128i hi = stbi__float_to_half_sse2(_mm_loadu_ps(in + i + 4));
+         _mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(lo, hi));
+      }
+   }
+#endif
+   for (; i < n; ++i)
+      out[i] = stbi__float_to_half(in[i]);
+}
+
+// convert n unorm16 samples to halves in place
+static void stbi__unorm16_to_half_run(stbi__uint16 *data, int n)
+{
+   int i = 0;
+#ifdef STBI_SSE2
+   if (stbi__sse2_available()) {
+      __m128 max = _mm_set1_ps(65535.0f);
+      __m128i zero = _mm_setzero_si128();
+      for (; i+7 < n; i += 8) {
+         __m128i v = _mm_loadu_si128((__m128i const *) (data + i));
+         __m128 lo = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), max);
+         __m128 hi = _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), max);
+         _mm_storeu_si128((__m128i *) (data + i), _mm_packs_epi32(stbi__float_to_half_sse2(lo), stbi__float_to_half_sse2(hi)));
+      }
+   }
+#endif
+   for (; i < n; ++i)
+      data[i] = stbi__float_to_half(data[i] / 65535.0f);
+}
+
+static stbi__uint16 *stbi__loadh_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__uint16 *result;
+   #ifndef STBI_NO_HDR
+   if (stbi__hdr_test(s)) {
+      stbi__result_info ri;
+      float *hdr_data;
+      int channels;
+      size_t count;
+      hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
+      if (hdr_data == NULL)
+         return (stbi__uint16 *) stbi__limit_result(NULL);
+      channels = req_comp ? req_comp : *comp;
+      count = (size_t) *x * *y * channels;
+      // convert in place, then give back the half of the buffer we don't need
+      result = (stbi__uint16 *) hdr_data;
+      stbi__float_to_half_run(result, hdr_data, (int) count);
+      result = (stbi__uint16 *) stbi__realloc_sized(result, count * sizeof(float), count * sizeof(stbi__uint16));
+      if (result == NULL)
+         result = (stbi__uint16 *) hdr_data;
+      if (stbi__vertically_flip_on_load)
+         stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
+      return result;
+   }
+   #endif
+   result = stbi__load_and_postprocess_16bit(s, x, y, comp, req_comp);
+   if (result)
+      stbi__unorm16_to_half_run(result, *x * *y * (req_comp ? req_comp : *comp));
+   return result;
+}
+
 #ifndef STBI_NO_STDIO
 
 #if defined(_MSC_VER) && defined(STBI_WINDOWS_UTF8)
@@ -1349,6 +1745,29 @@ STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, i
    return result;
 }
 
+STBIDEF stbi_us *stbi_loadh_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__uint16 *result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   result = stbi__loadh_main(&s,x,y,comp,req_comp);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+
+STBIDEF stbi_us *stbi_loadh(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi__uint16 *result;
+   if (!f) return (stbi_us *) stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_loadh_from_file(f,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
 
 #endif //!STBI_NO_STDIO
 
@@ -1366,6 +1785,20 @@ STBIDEF stbi_us *stbi_load_16_from_callbacks(stbi_io_callbacks const *clbk, void
    return stbi__load_and_postprocess_16bit(&s,x,y,channels_in_file,desired_channels);
 }
 
+STBIDEF stbi_us *stbi_loadh_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__loadh_main(&s,x,y,channels_in_file,desired_channels);
+}
+
+STBIDEF stbi_us *stbi_loadh_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+   return stbi__loadh_main(&s,x,y,channels_in_file,desired_channels);
+}
+
 STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -1403,15 +1836,18 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
    #ifndef STBI_NO_HDR
    if (stbi__hdr_test(s)) {
       stbi__result_info ri;
-      float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
+      float *hdr_data;
+      hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
       if (hdr_data)
          stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
-      return hdr_data;
+      return (float *) stbi__limit_result(hdr_data);
    }
    #endif
    data = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
    if (data)
-      return stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
+      return (float *) stbi__limit_result(stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp));
+   if (stbi__limit_hit)
+      return NULL; // failure reason already set
    return stbi__errpf("unknown image type", "Image not of any known type, or corrupt");
 }
 
@@ -1691,9 +2127,38 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
+// convert one scanline with img_n components to one with req_comp components;
+// avoid switch per pixel, so use switch per scanline and massive macros
+static int stbi__convert_format_row(unsigned char *src, unsigned char *dest, int img_n, int req_comp, unsigned int x)
+{
+   int i;
+
+   if (req_comp == img_n) { memcpy(dest, src, (size_t) x * img_n); return 1; }
+
+   #define STBI__COMBO(a,b)  ((a)*8+(b))
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
+      default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
+   }
+   #undef STBI__CASE
+   return 1;
+}
+
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-   int i,j;
+   int j;
    unsigned char *good;
 
    if (req_comp == img_n) return data;
@@ -1701,37 +2166,17 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 
    good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return stbi__errpuc("outofmem", "Out of memory");
    }
 
    for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+      if (!stbi__convert_format_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x)) {
+         stbi__free(data); stbi__free(good); return NULL;
       }
-      #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1748,9 +2193,36 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
 // nothing
 #else
+static int stbi__convert_format16_row(stbi__uint16 *src, stbi__uint16 *dest, int img_n, int req_comp, unsigned int x)
+{
+   int i;
+
+   if (req_comp == img_n) { memcpy(dest, src, (size_t) x * img_n * 2); return 1; }
+
+   #define STBI__COMBO(a,b)  ((a)*8+(b))
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
+      default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
+   }
+   #undef STBI__CASE
+   return 1;
+}
+
 static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-   int i,j;
+   int j;
    stbi__uint16 *good;
 
    if (req_comp == img_n) return data;
@@ -1758,37 +2230,17 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free(data);
       return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
    }
 
    for (j=0; j < (int) y; ++j) {
-      stbi__uint16 *src  = data + j * x * img_n   ;
-      stbi__uint16 *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+      if (!stbi__convert_format16_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x)) {
+         stbi__free(data); stbi__free(good); return NULL;
       }
-      #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free(data);
    return good;
 }
 #endif
@@ -1800,7 +2252,7 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
    float *output;
    if (!data) return NULL;
    output = (float *) stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1813,20 +2265,48 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
          output[i*comp + n] = data[i*comp + n]/255.0f;
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
 
 #ifndef STBI_NO_HDR
 #define stbi__float2int(x)   ((int) (x))
+// same mapping as stbi__hdr_to_ldr, but to the full 16-bit range for stbi_load_16
+static stbi__uint16 *stbi__hdr_to_ldr16(float *data, int x, int y, int comp)
+{
+   int i,k,n;
+   stbi__uint16 *output;
+   if (!data) return NULL;
+   output = (stbi__uint16 *) stbi__malloc_mad4(x, y, comp, 2, 0);
+   if (output == NULL) { stbi__free(data); return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory"); }
+   // compute number of non-alpha components
+   if (comp & 1) n = comp; else n = comp-1;
+   for (i=0; i < x*y; ++i) {
+      for (k=0; k < n; ++k) {
+         float z = (float) pow(data[i*comp+k]*stbi__h2l_scale_i, stbi__h2l_gamma_i) * 65535 + 0.5f;
+         if (z < 0) z = 0;
+         if (z > 65535) z = 65535;
+         output[i*comp + k] = (stbi__uint16) stbi__float2int(z);
+      }
+      if (k < comp) {
+         float z = data[i*comp+k] * 65535 + 0.5f;
+         if (z < 0) z = 0;
+         if (z > 65535) z = 65535;
+         output[i*comp + k] = (stbi__uint16) stbi__float2int(z);
+      }
+   }
+   stbi__free(data);
+   return output;
+}
+
 static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
    stbi_uc *output;
    if (!data) return NULL;
    output = (stbi_uc *) stbi__malloc_mad3(x, y, comp, 0);
-   if (output == NULL) { STBI_FREE(data); return stbi__errpuc("outofmem", "Out of memory"); }
+   if (output == NULL) { stbi__free(data); return stbi__errpuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
@@ -1843,7 +2323,7 @@ static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = (stbi_uc) stbi__float2int(z);
       }
    }
-   STBI_FREE(data);
+   stbi__free(data);
    return output;
 }
 #endif
@@ -3003,14 +3483,19 @@ static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
       data[i] *= dequant[i];
 }
 
-static void stbi__jpeg_finish(stbi__jpeg *z)
+static int stbi__jpeg_alloc_component_data(stbi__jpeg *z, int n);
+
+static int stbi__jpeg_finish(stbi__jpeg *z)
 {
    if (z->progressive) {
-      // dequantize and idct the data
+      // dequantize and idct the data, one component at a time; each
+      // component's coefficients are released as soon as its samples exist
       int i,j,n;
       for (n=0; n < z->s->img_n; ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
+         if (!stbi__jpeg_alloc_component_data(z, n))
+            return stbi__err("outofmem", "Out of memory");
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
@@ -3018,8 +3503,12 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
                z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
             }
          }
+         stbi__free(z->img_comp[n].raw_coeff);
+         z->img_comp[n].raw_coeff = NULL;
+         z->img_comp[n].coeff = NULL;
       }
    }
+   return 1;
 }
 
 static int stbi__process_marker(stbi__jpeg *z, int m)
@@ -3169,23 +3658,33 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    int i;
    for (i=0; i < ncomp; ++i) {
       if (z->img_comp[i].raw_data) {
-         STBI_FREE(z->img_comp[i].raw_data);
+         stbi__free(z->img_comp[i].raw_data);
          z->img_comp[i].raw_data = NULL;
          z->img_comp[i].data = NULL;
       }
       if (z->img_comp[i].raw_coeff) {
-         STBI_FREE(z->img_comp[i].raw_coeff);
+         stbi__free(z->img_comp[i].raw_coeff);
          z->img_comp[i].raw_coeff = 0;
          z->img_comp[i].coeff = 0;
       }
       if (z->img_comp[i].linebuf) {
-         STBI_FREE(z->img_comp[i].linebuf);
+         stbi__free(z->img_comp[i].linebuf);
          z->img_comp[i].linebuf = NULL;
       }
    }
    return why;
 }
 
+static int stbi__jpeg_alloc_component_data(stbi__jpeg *z, int n)
+{
+   z->img_comp[n].raw_data = stbi__malloc_mad2(z->img_comp[n].w2, z->img_comp[n].h2, 15);
+   if (z->img_comp[n].raw_data == NULL)
+      return 0;
+   // align blocks for idct using mmx/sse
+   z->img_comp[n].data = (stbi_uc*) (((size_t) z->img_comp[n].raw_data + 15) & ~15);
+   return 1;
+}
+
 static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 {
    stbi__context *s = z->s;
@@ -3220,6 +3719,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 
    if (scan != STBI__SCAN_load) return 1;
 
+   if (!stbi__within_limits(s->img_x, s->img_y)) return 0;
    if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
 
    for (i=0; i < s->img_n; ++i) {
@@ -3252,11 +3752,6 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-      if (z->img_comp[i].raw_data == NULL)
-         return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
-      // align blocks for idct using mmx/sse
-      z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
          // w2, h2 are multiples of 8 (see above)
          z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
@@ -3265,7 +3760,13 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
+         // the sample plane isn't needed until stbi__jpeg_finish, which
+         // allocates it one component at a time as the coefficients are
+         // retired, so peak memory is coefficients + one plane, not both
+         continue;
       }
+      if (!stbi__jpeg_alloc_component_data(z, i))
+         return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
    }
 
    return 1;
@@ -3341,7 +3842,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
       m = stbi__get_marker(j);
    }
    if (j->progressive)
-      stbi__jpeg_finish(j);
+      return stbi__jpeg_finish(j);
    return 1;
 }
 
@@ -3761,6 +4262,59 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+// fast path for images with no chroma subsampling (4:4:4 and grayscale):
+// every component plane is already at full resolution, so skip the line
+// buffers and resamplers and convert straight out of the planes
+static stbi_uc *stbi__jpeg_load_unsampled(stbi__jpeg *z, int n, int is_rgb)
+{
+   stbi__context *s = z->s;
+   int w2 = z->img_comp[0].w2; // same for every component when h_max == 1
+   stbi_uc *output;
+   unsigned int i,j;
+
+   if (s->img_n == 1 && n == 1) {
+      // compact the decoded plane in place and hand it back as the result;
+      // row j never moves past the start of row j+1, so this is safe in order
+      output = (stbi_uc *) z->img_comp[0].raw_data;
+      for (j=0; j < s->img_y; ++j)
+         memmove(output + s->img_x * j, z->img_comp[0].data + w2 * j, s->img_x);
+      z->img_comp[0].raw_data = NULL;
+      z->img_comp[0].data = NULL;
+      return output;
+   }
+
+   output = (stbi_uc *) stbi__malloc_mad3(n, s->img_x, s->img_y, 1);
+   if (!output) return stbi__errpuc("outofmem", "Out of memory");
+
+   for (j=0; j < s->img_y; ++j) {
+      stbi_uc *out = output + n * s->img_x * j;
+      stbi_uc *y = z->img_comp[0].data + w2 * j;
+      if (s->img_n == 1) {
+         if (n == 2)
+            for (i=0; i < s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         else
+            for (i=0; i < s->img_x; ++i, out += n) {
+               out[0] = out[1] = out[2] = y[i];
+               if (n == 4) out[3] = 255;
+            }
+      } else {
+         stbi_uc *c1 = z->img_comp[1].data + w2 * j;
+         stbi_uc *c2 = z->img_comp[2].data + w2 * j;
+         if (is_rgb) {
+            for (i=0; i < s->img_x; ++i, out += n) {
+               out[0] = y[i];
+               out[1] = c1[i];
+               out[2] = c2[i];
+               if (n == 4) out[3] = 255;
+            }
+         } else {
+            z->YCbCr_to_RGB_kernel(out, y, c1, c2, s->img_x, n);
+         }
+      }
+   }
+   return output;
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3782,6 +4336,16 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    else
       decode_n = z->s->img_n;
 
+   if (z->img_h_max == 1 && z->img_v_max == 1 && (z->s->img_n == 1 || (z->s->img_n == 3 && n >= 3))) {
+      stbi_uc *output = stbi__jpeg_load_unsampled(z, n, is_rgb);
+      stbi__cleanup_jpeg(z);
+      if (!output) return NULL;
+      *out_x = z->s->img_x;
+      *out_y = z->s->img_y;
+      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+      return output;
+   }
+
    // resample and color-convert
    {
       int k;
@@ -3925,10 +4489,11 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    unsigned char* result;
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    STBI_NOTUSED(ri);
+   if (!j) return stbi__errpuc("outofmem", "Out of memory");
    j->s = s;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
 
@@ -3936,11 +4501,12 @@ static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
    stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return 0;
    j->s = s;
    stbi__setup_jpeg(j);
    r = stbi__decode_jpeg_header(j, STBI__SCAN_type);
    stbi__rewind(s);
-   STBI_FREE(j);
+   stbi__free(j);
    return r;
 }
 
@@ -3960,9 +4526,10 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 {
    int result;
    stbi__jpeg* j = (stbi__jpeg*) (stbi__malloc(sizeof(stbi__jpeg)));
+   if (!j) return stbi__err("outofmem", "Out of memory");
    j->s = s;
    result = stbi__jpeg_info_raw(j, x, y, comp);
-   STBI_FREE(j);
+   stbi__free(j);
    return result;
 }
 #endif
@@ -4159,7 +4726,7 @@ static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room
       if(limit > UINT_MAX / 2) return stbi__err("outofmem", "Out of memory");
       limit *= 2;
    }
-   q = (char *) STBI_REALLOC_SIZED(z->zout_start, old_limit, limit);
+   q = (char *) stbi__realloc_sized(z->zout_start, old_limit, limit);
    STBI_NOTUSED(old_limit);
    if (q == NULL) return stbi__err("outofmem", "Out of memory");
    z->zout_start = q;
@@ -4387,7 +4954,9 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    stbi__zbuf a;
-   char *p = (char *) stbi__malloc(initial_size);
+   char *p;
+   stbi__begin_load();
+   p = (char *) stbi__malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer + len;
@@ -4395,7 +4964,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4408,7 +4977,9 @@ STBIDEF char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
 STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
    stbi__zbuf a;
-   char *p = (char *) stbi__malloc(initial_size);
+   char *p;
+   stbi__begin_load();
+   p = (char *) stbi__malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer + len;
@@ -4416,7 +4987,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4424,6 +4995,7 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
 STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int ilen)
 {
    stbi__zbuf a;
+   stbi__begin_load();
    a.zbuffer = (stbi_uc *) ibuffer;
    a.zbuffer_end = (stbi_uc *) ibuffer + ilen;
    if (stbi__do_zlib(&a, obuffer, olen, 0, 1))
@@ -4435,7 +5007,9 @@ STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer
 STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    stbi__zbuf a;
-   char *p = (char *) stbi__malloc(16384);
+   char *p;
+   stbi__begin_load();
+   p = (char *) stbi__malloc(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer+len;
@@ -4443,7 +5017,7 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      STBI_FREE(a.zout_start);
+      stbi__free(a.zout_start);
       return NULL;
    }
 }
@@ -4451,6 +5025,7 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
 STBIDEF int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen)
 {
    stbi__zbuf a;
+   stbi__begin_load();
    a.zbuffer = (stbi_uc *) ibuffer;
    a.zbuffer_end = (stbi_uc *) ibuffer + ilen;
    if (stbi__do_zlib(&a, obuffer, olen, 0, 0))
@@ -4499,6 +5074,9 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   int req_bpc;  // bits per channel the caller will end up converting to
+   int out_bpc;  // bits per channel actually stored in out
+   int flipped;  // out was written bottom-up
 } stbi__png;
 
 
@@ -4759,6 +5337,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
 
    // de-interlacing
    final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
+   if (!final) return stbi__err("outofmem", "Out of memory");
    for (p=0; p < 7; ++p) {
       int xorig[] = { 0,4,0,2,0,1,0 };
       int yorig[] = { 0,0,4,0,2,0,1 };
@@ -4771,7 +5350,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-            STBI_FREE(final);
+            stbi__free(final);
             return 0;
          }
          for (j=0; j < y; ++j) {
@@ -4782,7 +5361,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
          }
-         STBI_FREE(a->out);
+         stbi__free(a->out);
          image_data += img_len;
          image_data_len -= img_len;
       }
@@ -4792,11 +5371,9 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+static void stbi__compute_transparency(stbi_uc *p, stbi__uint32 pixel_count, stbi_uc tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 255 as the alpha value in the output
@@ -4814,14 +5391,11 @@ static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
          p += 4;
       }
    }
-   return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n)
+static void stbi__compute_transparency16(stbi__uint16 *p, stbi__uint32 pixel_count, stbi__uint16 tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi__uint16 *p = (stbi__uint16*) z->out;
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 65535 as the alpha value in the output
@@ -4839,44 +5413,21 @@ static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int ou
          p += 4;
       }
    }
-   return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+// always expands to 4 channels; the caller narrows to the palette's real
+// channel count (or req_comp) in the same pass
+static void stbi__expand_png_palette(stbi_uc *p, const stbi_uc *orig, stbi__uint32 pixel_count, stbi_uc *palette)
 {
-   stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-   stbi_uc *p, *temp_out, *orig = a->out;
-
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-   if (p == NULL) return stbi__err("outofmem", "Out of memory");
-
-   // between here and free(out) below, exitting would leak
-   temp_out = p;
-
-   if (pal_img_n == 3) {
-      for (i=0; i < pixel_count; ++i) {
-         int n = orig[i]*4;
-         p[0] = palette[n  ];
-         p[1] = palette[n+1];
-         p[2] = palette[n+2];
-         p += 3;
-      }
-   } else {
-      for (i=0; i < pixel_count; ++i) {
-         int n = orig[i]*4;
-         p[0] = palette[n  ];
-         p[1] = palette[n+1];
-         p[2] = palette[n+2];
-         p[3] = palette[n+3];
-         p += 4;
-      }
+   stbi__uint32 i;
+   for (i=0; i < pixel_count; ++i) {
+      int n = orig[i]*4;
+      p[0] = palette[n  ];
+      p[1] = palette[n+1];
+      p[2] = palette[n+2];
+      p[3] = palette[n+3];
+      p += 4;
    }
-   STBI_FREE(a->out);
-   a->out = temp_out;
-
-   STBI_NOTUSED(len);
-
-   return 1;
 }
 
 static int stbi__unpremultiply_on_load = 0;
@@ -4892,13 +5443,11 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
    stbi__de_iphone_flag = flag_true_if_should_convert;
 }
 
-static void stbi__de_iphone(stbi__png *z)
+static void stbi__de_iphone(stbi_uc *p, stbi__uint32 pixel_count, int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+   stbi__uint32 i;
 
-   if (s->img_out_n == 3) {  // convert bgr to rgb
+   if (out_n == 3) {  // convert bgr to rgb
       for (i=0; i < pixel_count; ++i) {
          stbi_uc t = p[0];
          p[0] = p[2];
@@ -4906,7 +5455,7 @@ static void stbi__de_iphone(stbi__png *z)
          p += 3;
       }
    } else {
-      STBI_ASSERT(s->img_out_n == 4);
+      STBI_ASSERT(out_n == 4);
       if (stbi__unpremultiply_on_load) {
          // convert bgr to rgb and unpremultiply
          for (i=0; i < pixel_count; ++i) {
@@ -4935,6 +5484,116 @@ static void stbi__de_iphone(stbi__png *z)
    }
 }
 
+typedef struct
+{
+   int has_trans, de_iphone;
+   stbi_uc tc[3];
+   stbi__uint16 tc16[3];
+   stbi_uc *palette;   // NULL unless paletted
+   int req_comp;
+} stbi__png_post;
+
+// apply the in-place per-pixel fixups to one row of z->out
+static void stbi__png_fixup_row(stbi__png *z, stbi__png_post *post, stbi_uc *row, int n)
+{
+   stbi__uint32 x = z->s->img_x;
+   if (post->has_trans) {
+      if (z->depth == 16)
+         stbi__compute_transparency16((stbi__uint16 *) row, x, post->tc16, n);
+      else
+         stbi__compute_transparency(row, x, post->tc, n);
+   }
+   if (post->de_iphone)
+      stbi__de_iphone(row, x, n);
+}
+
+// single pass over the unfiltered image that does tRNS color keying, iPhone
+// BGR swap, palette expansion, conversion to req_comp, 16->8 reduction and
+// the vertical flip, one row at a time while that row is still in cache.
+// each of these used to be its own full pass (and often its own buffer).
+static int stbi__png_postprocess(stbi__png *z, stbi__png_post *post)
+{
+   stbi__context *s = z->s;
+   stbi__uint32 x = s->img_x, y = s->img_y, j;
+   int in_n  = s->img_out_n;
+   int src_n = post->palette ? 4 : in_n;
+   int out_n = post->req_comp ? post->req_comp : post->palette ? s->img_n : in_n;
+   int reduce = z->depth == 16 && z->req_bpc == 8;
+   int in_bytes  = z->depth == 16 ? 2 : 1;
+   int out_bytes = reduce ? 1 : in_bytes;
+   int flip = stbi__vertically_flip_on_load;
+   size_t in_stride  = (size_t) x * in_n * in_bytes;
+   size_t out_stride = (size_t) x * out_n * out_bytes;
+   stbi_uc *final, *scratch = NULL;
+
+   z->out_bpc = out_bytes * 8;
+   z->flipped = flip;
+   s->img_out_n = out_n;
+
+   if (!post->palette && !reduce && in_n == out_n) {
+      // same layout in and out: fix up in place, swapping row pairs if flipping
+      if (!post->has_trans && !post->de_iphone && !flip)
+         return 1;
+      if (flip) {
+         scratch = (stbi_uc *) stbi__malloc(in_stride);
+         if (!scratch) return stbi__err("outofmem", "Out of memory");
+      }
+      for (j=0; j < (y+1) >> 1; ++j) {
+         stbi_uc *row0 = z->out + j * in_stride;
+         stbi_uc *row1 = z->out + (y-1-j) * in_stride;
+         stbi__png_fixup_row(z, post, row0, in_n);
+         if (row1 != row0) {
+            stbi__png_fixup_row(z, post, row1, in_n);
+            if (flip) {
+               memcpy(scratch, row0, in_stride);
+               memcpy(row0, row1, in_stride);
+               memcpy(row1, scratch, in_stride);
+            }
+         }
+      }
+      stbi__free(scratch);
+      return 1;
+   }
+
+   final = (stbi_uc *) stbi__malloc_mad3(x, y, out_n * out_bytes, 0);
+   if (!final) return stbi__err("outofmem", "Out of memory");
+   // one row of 4-channel palette output, or of req_comp 16-bit output before reduction
+   scratch = (stbi_uc *) stbi__malloc_mad2(x, 8, 0);
+   if (!scratch) { stbi__free(final); return stbi__err("outofmem", "Out of memory"); }
+
+   for (j=0; j < y; ++j) {
+      stbi_uc *src  = z->out + j * in_stride;
+      stbi_uc *dest = final + (flip ? y-1-j : j) * out_stride;
+      int ok;
+      stbi__png_fixup_row(z, post, src, in_n);
+      if (post->palette) {
+         stbi__expand_png_palette(scratch, src, x, post->palette);
+         src = scratch;
+      }
+      if (z->depth == 16) {
+         if (reduce) {
+            stbi__uint16 *wide = (stbi__uint16 *) src;
+            stbi__uint32 i, count = x * out_n;
+            if (src_n != out_n) {
+               wide = (stbi__uint16 *) scratch;
+               ok = stbi__convert_format16_row((stbi__uint16 *) src, wide, src_n, out_n, x);
+            } else
+               ok = 1;
+            for (i=0; i < count; ++i)
+               dest[i] = (stbi_uc)((wide[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+         } else
+            ok = stbi__convert_format16_row((stbi__uint16 *) src, (stbi__uint16 *) dest, src_n, out_n, x);
+      } else
+         ok = stbi__convert_format_row(src, dest, src_n, out_n, x);
+      if (!ok) { stbi__free(final); stbi__free(scratch); return 0; }
+   }
+
+   stbi__free(scratch);
+   stbi__free(z->out);
+   z->out = final;
+   return 1;
+}
+
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
@@ -4942,6 +5601,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
    stbi_uc palette[1024], pal_img_n=0;
    stbi_uc has_trans=0, tc[3]={0};
    stbi__uint16 tc16[3];
+   stbi__png_post post;
    stbi__uint32 ioff=0, idata_limit=0, i, pal_len=0;
    int first=1,k,interlace=0, color=0, is_iphone=0;
    stbi__context *s = z->s;
@@ -4970,6 +5630,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             s->img_y = stbi__get32be(s);
             if (s->img_y > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
             if (s->img_x > STBI_MAX_DIMENSIONS) return stbi__err("too large","Very large image (corrupt?)");
+            if (scan == STBI__SCAN_load && !stbi__within_limits(s->img_x, s->img_y)) return 0;
             z->depth = stbi__get8(s);  if (z->depth != 1 && z->depth != 2 && z->depth != 4 && z->depth != 8 && z->depth != 16)  return stbi__err("1/2/4/8/16-bit only","PNG not supported: 1/2/4/8/16-bit only");
             color = stbi__get8(s);  if (color > 6)         return stbi__err("bad ctype","Corrupt PNG");
             if (color == 3 && z->depth == 16)                  return stbi__err("bad ctype","Corrupt PNG");
@@ -5041,7 +5702,7 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                while (ioff + c.length > idata_limit)
                   idata_limit *= 2;
                STBI_NOTUSED(idata_limit_old);
-               p = (stbi_uc *) STBI_REALLOC_SIZED(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
+               p = (stbi_uc *) stbi__realloc_sized(z->idata, idata_limit_old, idata_limit); if (p == NULL) return stbi__err("outofmem", "Out of memory");
                z->idata = p;
             }
             if (!stbi__getn(s, z->idata+ioff,c.length)) return stbi__err("outofdata","Corrupt PNG");
@@ -5059,33 +5720,28 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
             z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
+            stbi__free(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
             if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
-            if (has_trans) {
-               if (z->depth == 16) {
-                  if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
-               } else {
-                  if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
-               }
-            }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
-               stbi__de_iphone(z);
+            stbi__free(z->expanded); z->expanded = NULL;
+            post.has_trans = has_trans;
+            post.de_iphone = is_iphone && stbi__de_iphone_flag && s->img_out_n > 2 && z->depth == 8;
+            post.palette = pal_img_n ? palette : NULL;
+            post.req_comp = req_comp;
+            memcpy(post.tc, tc, sizeof(tc));
+            if (has_trans && z->depth == 16) memcpy(post.tc16, tc16, sizeof(tc16));
             if (pal_img_n) {
                // pal_img_n == 3 or 4
                s->img_n = pal_img_n; // record the actual colors we had
-               s->img_out_n = pal_img_n;
-               if (req_comp >= 3) s->img_out_n = req_comp;
-               if (!stbi__expand_png_palette(z, palette, pal_len, s->img_out_n))
-                  return 0;
-            } else if (has_trans) {
+            }
+            if (!stbi__png_postprocess(z, &post)) return 0;
+            if (!pal_img_n && has_trans) {
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
             }
-            STBI_FREE(z->expanded); z->expanded = NULL;
             // end of PNG chunk, read and skip CRC
             stbi__get32be(s);
             return 1;
@@ -5118,37 +5774,30 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
    void *result=NULL;
    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
    if (stbi__parse_png_file(p, STBI__SCAN_load, req_comp)) {
-      if (p->depth <= 8)
-         ri->bits_per_channel = 8;
-      else if (p->depth == 16)
-         ri->bits_per_channel = 16;
+      if (p->out_bpc == 8 || p->out_bpc == 16)
+         ri->bits_per_channel = p->out_bpc;
       else
          return stbi__errpuc("bad bits_per_channel", "PNG not supported: unsupported color depth");
+      // channel conversion and flipping were already done by stbi__png_postprocess
+      ri->flipped = p->flipped;
       result = p->out;
       p->out = NULL;
-      if (req_comp && req_comp != p->s->img_out_n) {
-         if (ri->bits_per_channel == 8)
-            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
-         else
-            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
-         p->s->img_out_n = req_comp;
-         if (result == NULL) return result;
-      }
       *x = p->s->img_x;
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__free(p->out);      p->out      = NULL;
+   stbi__free(p->expanded); p->expanded = NULL;
+   stbi__free(p->idata);    p->idata    = NULL;
 
    return result;
 }
 
-static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    stbi__png p;
    p.s = s;
+   p.req_bpc = bpc;
    return stbi__do_png(&p, x,y,comp,req_comp, ri);
 }
 
@@ -5360,6 +6009,108 @@ static void *stbi__bmp_parse_header(stbi__context *s, stbi__bmp_data *info)
 }
 
 
+// 16/24/32-bit pixel layouts with a dedicated row converter; anything else
+// goes through stbi__shiftsigned per channel
+enum
+{
+   STBI__BMP_generic,
+   STBI__BMP_bgr24,
+   STBI__BMP_bgra32,  // also BGRX (no alpha mask)
+   STBI__BMP_rgb565,
+   STBI__BMP_rgb555
+};
+
+static void stbi__bmp_read_row(stbi__context *s, stbi_uc *row, int n)
+{
+   int i;
+   if (!stbi__getn(s, row, n)) {
+      // short file: take what's left byte by byte, zeros after that
+      for (i=0; i < n; ++i)
+         row[i] = stbi__get8(s);
+   }
+}
+
+static void stbi__bmp_bgr24_row(stbi_uc *dest, const stbi_uc *src, int w, int target)
+{
+   int i;
+   if (target == 4) {
+      for (i=0; i < w; ++i, src += 3, dest += 4) {
+         dest[0] = src[2];
+         dest[1] = src[1];
+         dest[2] = src[0];
+         dest[3] = 255;
+      }
+   } else {
+      for (i=0; i < w; ++i, src += 3, dest += 3) {
+         dest[0] = src[2];
+         dest[1] = src[1];
+         dest[2] = src[0];
+      }
+   }
+}
+
+// returns the OR of all alpha values, for the all-zero-alpha check
+static unsigned int stbi__bmp_bgra32_row(stbi_uc *dest, const stbi_uc *src, int w, int target, int has_alpha)
+{
+   unsigned int all_a = has_alpha ? 0 : 255;
+   int i = 0;
+   if (target == 4) {
+#ifdef STBI_SSE2
+      if (stbi__sse2_available()) {
+         // per 32-bit lane: 0xAARRGGBB -> 0xAABBGGRR
+         __m128i ag_mask = _mm_set1_epi32((int) 0xff00ff00);
+         __m128i b_mask  = _mm_set1_epi32(0xff);
+         __m128i alpha   = _mm_set1_epi32(has_alpha ? 0 : (int) 0xff000000);
+         __m128i a_or    = _mm_setzero_si128();
+         for (; i+3 < w; i += 4) {
+            __m128i v  = _mm_loadu_si128((const __m128i *) (src + 4*i));
+            __m128i ag = _mm_and_si128(v, ag_mask);
+            __m128i r  = _mm_and_si128(_mm_srli_epi32(v, 16), b_mask);
+            __m128i b  = _mm_slli_epi32(_mm_and_si128(v, b_mask), 16);
+            __m128i o  = _mm_or_si128(_mm_or_si128(ag, alpha), _mm_or_si128(r, b));
+            a_or = _mm_or_si128(a_or, o);
+            _mm_storeu_si128((__m128i *) (dest + 4*i), o);
+         }
+         a_or = _mm_or_si128(a_or, _mm_srli_si128(a_or, 8));
+         a_or = _mm_or_si128(a_or, _mm_srli_si128(a_or, 4));
+         all_a |= (unsigned int) _mm_cvtsi128_si32(a_or) >> 24;
+      }
+#endif
+      for (; i < w; ++i) {
+         stbi_uc a = has_alpha ? src[4*i+3] : 255;
+         dest[4*i+0] = src[4*i+2];
+         dest[4*i+1] = src[4*i+1];
+         dest[4*i+2] = src[4*i+0];
+         dest[4*i+3] = a;
+         all_a |= a;
+      }
+   } else {
+      for (; i < w; ++i) {
+         dest[3*i+0] = src[4*i+2];
+         dest[3*i+1] = src[4*i+1];
+         dest[3*i+2] = src[4*i+0];
+         if (has_alpha) all_a |= src[4*i+3];
+      }
+   }
+   return all_a;
+}
+
+// 565 or 555; expands n-bit channels by bit replication, matching stbi__shiftsigned
+static void stbi__bmp_rgb16_row(stbi_uc *dest, const stbi_uc *src, int w, int target, int gbits)
+{
+   int i;
+   for (i=0; i < w; ++i, src += 2, dest += target) {
+      unsigned int v = src[0] | (src[1] << 8);
+      unsigned int r = (v >> (5 + gbits)) & 31;
+      unsigned int g = (v >> 5) & ((1 << gbits) - 1);
+      unsigned int b = v & 31;
+      dest[0] = (stbi_uc) ((r << 3) | (r >> 2));
+      dest[1] = (stbi_uc) (gbits == 6 ? (g << 2) | (g >> 4) : (g << 3) | (g >> 2));
+      dest[2] = (stbi_uc) ((b << 3) | (b >> 2));
+      if (target == 4) dest[3] = 255;
+   }
+}
+
 static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    stbi_uc *out;
@@ -5379,6 +6130,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
 
    if (s->img_y > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
    if (s->img_x > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
+   if (!stbi__within_limits(s->img_x, s->img_y)) return NULL;
 
    mr = info.mr;
    mg = info.mg;
@@ -5417,7 +6169,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!out) return stbi__errpuc("outofmem", "Out of memory");
    if (info.bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { STBI_FREE(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi__free(out); return stbi__errpuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = stbi__get8(s);
          pal[i][1] = stbi__get8(s);
@@ -5429,7 +6181,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) width = (s->img_x + 7) >> 3;
       else if (info.bpp == 4) width = (s->img_x + 1) >> 1;
       else if (info.bpp == 8) width = s->img_x;
-      else { STBI_FREE(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
+      else { stbi__free(out); return stbi__errpuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
@@ -5472,55 +6224,63 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       }
    } else {
       int rshift=0,gshift=0,bshift=0,ashift=0,rcount=0,gcount=0,bcount=0,acount=0;
-      int z = 0;
-      int easy=0;
+      int layout = STBI__BMP_generic;
+      stbi_uc *row;
       stbi__skip(s, info.offset - info.extra_read - info.hsz);
       if (info.bpp == 24) width = 3 * s->img_x;
       else if (info.bpp == 16) width = 2*s->img_x;
       else /* bpp = 32 and pad = 0 */ width=0;
       pad = (-width) & 3;
       if (info.bpp == 24) {
-         easy = 1;
+         layout = STBI__BMP_bgr24;
       } else if (info.bpp == 32) {
-         if (mb == 0xff && mg == 0xff00 && mr == 0x00ff0000 && ma == 0xff000000)
-            easy = 2;
+         if (mb == 0xff && mg == 0xff00 && mr == 0x00ff0000 && (ma == 0xff000000 || ma == 0))
+            layout = STBI__BMP_bgra32;
+      } else if (info.bpp == 16 && ma == 0) {
+         if (mr == 0xf800 && mg == 0x07e0 && mb == 0x001f)
+            layout = STBI__BMP_rgb565;
+         else if (mr == 0x7c00 && mg == 0x03e0 && mb == 0x001f)
+            layout = STBI__BMP_rgb555;
       }
-      if (!easy) {
-         if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+      if (layout == STBI__BMP_generic) {
+         if (!mr || !mg || !mb) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
          gshift = stbi__high_bit(mg)-7; gcount = stbi__bitcount(mg);
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
-         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
+         if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { stbi__free(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
       }
+      row = (stbi_uc *) stbi__malloc_mad2(s->img_x, info.bpp/8, 4);
+      if (!row) { stbi__free(out); return stbi__errpuc("outofmem", "Out of memory"); }
       for (j=0; j < (int) s->img_y; ++j) {
-         if (easy) {
-            for (i=0; i < (int) s->img_x; ++i) {
-               unsigned char a;
-               out[z+2] = stbi__get8(s);
-               out[z+1] = stbi__get8(s);
-               out[z+0] = stbi__get8(s);
-               z += 3;
-               a = (easy == 2 ? stbi__get8(s) : 255);
-               all_a |= a;
-               if (target == 4) out[z++] = a;
-            }
-         } else {
-            int bpp = info.bpp;
-            for (i=0; i < (int) s->img_x; ++i) {
-               stbi__uint32 v = (bpp == 16 ? (stbi__uint32) stbi__get16le(s) : stbi__get32le(s));
-               unsigned int a;
-               out[z++] = STBI__BYTECAST(stbi__shiftsigned(v & mr, rshift, rcount));
-               out[z++] = STBI__BYTECAST(stbi__shiftsigned(v & mg, gshift, gcount));
-               out[z++] = STBI__BYTECAST(stbi__shiftsigned(v & mb, bshift, bcount));
-               a = (ma ? stbi__shiftsigned(v & ma, ashift, acount) : 255);
-               all_a |= a;
-               if (target == 4) out[z++] = STBI__BYTECAST(a);
+         // rows are written straight to their final (flipped) position
+         stbi_uc *dest = out + (size_t) (flip_vertically ? (int) s->img_y-1-j : j) * s->img_x * target;
+         stbi__bmp_read_row(s, row, s->img_x * (info.bpp/8) + pad);
+         switch (layout) {
+            case STBI__BMP_bgr24:  stbi__bmp_bgr24_row(dest, row, s->img_x, target); break;
+            case STBI__BMP_bgra32: all_a |= stbi__bmp_bgra32_row(dest, row, s->img_x, target, ma != 0); break;
+            case STBI__BMP_rgb565: stbi__bmp_rgb16_row(dest, row, s->img_x, target, 6); break;
+            case STBI__BMP_rgb555: stbi__bmp_rgb16_row(dest, row, s->img_x, target, 5); break;
+            default: {
+               stbi_uc *src = row;
+               for (i=0; i < (int) s->img_x; ++i) {
+                  stbi__uint32 v;
+                  unsigned int a;
+                  if (info.bpp == 16) { v = src[0] | (src[1] << 8); src += 2; }
+                  else { v = src[0] | (src[1] << 8) | ((stbi__uint32) src[2] << 16) | ((stbi__uint32) src[3] << 24); src += 4; }
+                  *dest++ = STBI__BYTECAST(stbi__shiftsigned(v & mr, rshift, rcount));
+                  *dest++ = STBI__BYTECAST(stbi__shiftsigned(v & mg, gshift, gcount));
+                  *dest++ = STBI__BYTECAST(stbi__shiftsigned(v & mb, bshift, bcount));
+                  a = (ma ? stbi__shiftsigned(v & ma, ashift, acount) : 255);
+                  all_a |= a;
+                  if (target == 4) *dest++ = STBI__BYTECAST(a);
+               }
             }
          }
-         stbi__skip(s, pad);
       }
+      stbi__free(row);
+      flip_vertically = 0;
    }
 
    // if alpha channel is all 0s, replace with all 255s
@@ -5528,16 +6288,8 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       for (i=4*s->img_x*s->img_y-1; i >= 0; i -= 4)
          out[i] = 255;
 
-   if (flip_vertically) {
-      stbi_uc t;
-      for (j=0; j < (int) s->img_y>>1; ++j) {
-         stbi_uc *p1 = out +      j     *s->img_x*target;
-         stbi_uc *p2 = out + (s->img_y-1-j)*s->img_x*target;
-         for (i=0; i < (int) s->img_x*target; ++i) {
-            t = p1[i]; p1[i] = p2[i]; p2[i] = t;
-         }
-      }
-   }
+   if (flip_vertically)
+      stbi__vertical_flip(out, s->img_x, s->img_y, target);
 
    if (req_comp && req_comp != target) {
       out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y);
@@ -5687,6 +6439,41 @@ static void stbi__tga_read_rgb16(stbi__context *s, stbi_uc* out)
    // so let's treat all 15 and 16bit TGAs as RGB with no alpha.
 }
 
+static void stbi__tga_swap_rb(stbi_uc *p, int count, int comp)
+{
+   int i;
+   for (i=0; i < count; ++i, p += comp) {
+      stbi_uc temp = p[0];
+      p[0] = p[2];
+      p[2] = temp;
+   }
+}
+
+// read one pixel of an indexed, RGB16 or RLE-repeated run, already in RGB order
+static void stbi__tga_read_pixel(stbi__context *s, stbi_uc *dest, int tga_comp, int tga_rgb16, int tga_bits_per_pixel, stbi_uc *tga_palette, int tga_palette_len)
+{
+   int j;
+   if ( tga_palette )
+   {
+      // read in index, then perform the lookup
+      int pal_idx = (tga_bits_per_pixel == 8) ? stbi__get8(s) : stbi__get16le(s);
+      if ( pal_idx >= tga_palette_len ) {
+         // invalid index
+         pal_idx = 0;
+      }
+      memcpy(dest, tga_palette + pal_idx*tga_comp, tga_comp);
+   } else if(tga_rgb16) {
+      STBI_ASSERT(tga_comp == STBI_rgb);
+      stbi__tga_read_rgb16(s, dest);
+   } else {
+      //   read in the data raw
+      for (j = 0; j < tga_comp; ++j)
+         dest[j] = stbi__get8(s);
+      if (tga_comp >= 3)
+         stbi__tga_swap_rb(dest, 1, tga_comp);
+   }
+}
+
 static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    //   read in the TGA header stuff
@@ -5708,17 +6495,14 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
    //   image data
    unsigned char *tga_data;
    unsigned char *tga_palette = NULL;
-   int i, j;
-   unsigned char raw_data[4] = {0};
-   int RLE_count = 0;
-   int RLE_repeating = 0;
-   int read_next_pixel = 1;
+   int i, j, run;
    STBI_NOTUSED(ri);
    STBI_NOTUSED(tga_x_origin); // @TODO
    STBI_NOTUSED(tga_y_origin); // @TODO
 
    if (tga_height > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
    if (tga_width > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
+   if (!stbi__within_limits(tga_width, tga_height)) return NULL;
 
    //   do a tiny bit of precessing
    if ( tga_image_type >= 8 )
@@ -5749,18 +6533,23 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
    // skip to the data's starting position (offset usually = 0)
    stbi__skip(s, tga_offset );
 
+   // RGB order is fixed up as data arrives (per row, per run, or once in
+   // the palette), so there's no separate swap pass over the image
    if ( !tga_indexed && !tga_is_RLE && !tga_rgb16 ) {
       for (i=0; i < tga_height; ++i) {
          int row = tga_inverted ? tga_height -i - 1 : i;
          stbi_uc *tga_row = tga_data + row*tga_width*tga_comp;
          stbi__getn(s, tga_row, tga_width * tga_comp);
+         if (tga_comp >= 3)
+            stbi__tga_swap_rb(tga_row, tga_width, tga_comp);
       }
    } else  {
+      int pixel_count = tga_width * tga_height;
       //   do I need to load a palette?
       if ( tga_indexed)
       {
          if (tga_palette_len == 0) {  /* you have to have at least one entry! */
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("bad palette", "Corrupt TGA");
          }
 
@@ -5769,7 +6558,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
          //   load the palette
          tga_palette = (unsigned char*)stbi__malloc_mad2(tga_palette_len, tga_comp, 0);
          if (!tga_palette) {
-            STBI_FREE(tga_data);
+            stbi__free(tga_data);
             return stbi__errpuc("outofmem", "Out of memory");
          }
          if (tga_rgb16) {
@@ -5780,102 +6569,52 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
                pal_entry += tga_comp;
             }
          } else if (!stbi__getn(s, tga_palette, tga_palette_len * tga_comp)) {
-               STBI_FREE(tga_data);
-               STBI_FREE(tga_palette);
+               stbi__free(tga_data);
+               stbi__free(tga_palette);
                return stbi__errpuc("bad palette", "Corrupt TGA");
+         } else if (tga_comp >= 3) {
+            stbi__tga_swap_rb(tga_palette, tga_palette_len, tga_comp);
          }
       }
-      //   load the data
-      for (i=0; i < tga_width * tga_height; ++i)
+      //   load the data a whole run at a time; without RLE the image is one long raw run
+      for (i=0; i < pixel_count; i += run)
       {
-         //   if I'm in RLE mode, do I need to get a RLE stbi__pngchunk?
+         stbi_uc *dest = tga_data + i*tga_comp;
+         int repeating = 0;
+         run = pixel_count - i;
          if ( tga_is_RLE )
          {
-            if ( RLE_count == 0 )
-            {
-               //   yep, get the next byte as a RLE command
-               int RLE_cmd = stbi__get8(s);
-               RLE_count = 1 + (RLE_cmd & 127);
-               RLE_repeating = RLE_cmd >> 7;
-               read_next_pixel = 1;
-            } else if ( !RLE_repeating )
-            {
-               read_next_pixel = 1;
+            int RLE_cmd = stbi__get8(s);
+            repeating = RLE_cmd >> 7;
+            if (1 + (RLE_cmd & 127) < run)
+               run = 1 + (RLE_cmd & 127);
+         }
+         if ( repeating )
+         {
+            stbi__tga_read_pixel(s, dest, tga_comp, tga_rgb16, tga_bits_per_pixel, tga_palette, tga_palette_len);
+            stbi__fill_run(dest, run, tga_comp);
+         } else if ( !tga_indexed && !tga_rgb16 )
+         {
+            if (!stbi__getn(s, dest, run * tga_comp)) {
+               // short file: take what's left byte by byte, zeros after that
+               for (j = 0; j < run * tga_comp; ++j)
+                  dest[j] = stbi__get8(s);
             }
+            if (tga_comp >= 3)
+               stbi__tga_swap_rb(dest, run, tga_comp);
          } else
          {
-            read_next_pixel = 1;
+            for (j = 0; j < run; ++j, dest += tga_comp)
+               stbi__tga_read_pixel(s, dest, tga_comp, tga_rgb16, tga_bits_per_pixel, tga_palette, tga_palette_len);
          }
-         //   OK, if I need to read a pixel, do it now
-         if ( read_next_pixel )
-         {
-            //   load however much data we did have
-            if ( tga_indexed )
-            {
-               // read in index, then perform the lookup
-               int pal_idx = (tga_bits_per_pixel == 8) ? stbi__get8(s) : stbi__get16le(s);
-               if ( pal_idx >= tga_palette_len ) {
-                  // invalid index
-                  pal_idx = 0;
-               }
-               pal_idx *= tga_comp;
-               for (j = 0; j < tga_comp; ++j) {
-                  raw_data[j] = tga_palette[pal_idx+j];
-               }
-            } else if(tga_rgb16) {
-               STBI_ASSERT(tga_comp == STBI_rgb);
-               stbi__tga_read_rgb16(s, raw_data);
-            } else {
-               //   read in the data raw
-               for (j = 0; j < tga_comp; ++j) {
-                  raw_data[j] = stbi__get8(s);
-               }
-            }
-            //   clear the reading flag for the next pixel
-            read_next_pixel = 0;
-         } // end of reading a pixel
-
-         // copy data
-         for (j = 0; j < tga_comp; ++j)
-           tga_data[i*tga_comp+j] = raw_data[j];
-
-         //   in case we're in RLE mode, keep counting down
-         --RLE_count;
       }
       //   do I need to invert the image?
       if ( tga_inverted )
-      {
-         for (j = 0; j*2 < tga_height; ++j)
-         {
-            int index1 = j * tga_width * tga_comp;
-            int index2 = (tga_height - 1 - j) * tga_width * tga_comp;
-            for (i = tga_width * tga_comp; i > 0; --i)
-            {
-               unsigned char temp = tga_data[index1];
-               tga_data[index1] = tga_data[index2];
-               tga_data[index2] = temp;
-               ++index1;
-               ++index2;
-            }
-         }
-      }
+         stbi__vertical_flip(tga_data, tga_width, tga_height, tga_comp);
       //   clear my palette, if I had one
       if ( tga_palette != NULL )
       {
-         STBI_FREE( tga_palette );
-      }
-   }
-
-   // swap RGB - if the source data was RGB16, it already is in the right order
-   if (tga_comp >= 3 && !tga_rgb16)
-   {
-      unsigned char* tga_pixel = tga_data;
-      for (i=0; i < tga_width * tga_height; ++i)
-      {
-         unsigned char temp = tga_pixel[0];
-         tga_pixel[0] = tga_pixel[2];
-         tga_pixel[2] = temp;
-         tga_pixel += tga_comp;
+         stbi__free( tga_palette );
       }
    }
 
@@ -5904,9 +6643,11 @@ static int stbi__psd_test(stbi__context *s)
    return r;
 }
 
+// decodes one channel into a contiguous plane; stbi__psd_interleave
+// then builds the RGBA pixels from the planes in a separate pass
 static int stbi__psd_decode_rle(stbi__context *s, stbi_uc *p, int pixelCount)
 {
-   int count, nleft, len;
+   int count, nleft, len, i;
 
    count = 0;
    while ((nleft = pixelCount - count) > 0) {
@@ -5917,31 +6658,69 @@ static int stbi__psd_decode_rle(stbi__context *s, stbi_uc *p, int pixelCount)
          // Copy next len+1 bytes literally.
          len++;
          if (len > nleft) return 0; // corrupt data
-         count += len;
-         while (len) {
-            *p = stbi__get8(s);
-            p += 4;
-            len--;
+         if (!stbi__getn(s, p, len)) {
+            // short file: take what's left byte by byte, zeros after that
+            for (i = 0; i < len; ++i)
+               p[i] = stbi__get8(s);
          }
+         count += len;
+         p += len;
       } else if (len > 128) {
-         stbi_uc   val;
          // Next -len+1 bytes in the dest are replicated from next source byte.
          // (Interpret len as a negative 8-bit int.)
          len = 257 - len;
          if (len > nleft) return 0; // corrupt data
-         val = stbi__get8(s);
+         memset(p, stbi__get8(s), len);
          count += len;
-         while (len) {
-            *p = val;
-            p += 4;
-            len--;
-         }
+         p += len;
       }
    }
 
    return 1;
 }
 
+// interleave four planes of pixelCount bytes each into RGBA pixels
+static void stbi__psd_interleave(stbi_uc *out, const stbi_uc *planes, int pixelCount)
+{
+   const stbi_uc *r = planes, *g = r + pixelCount, *b = g + pixelCount, *a = b + pixelCount;
+   int i = 0;
+
+#ifdef STBI_SSE2
+   if (stbi__sse2_available()) {
+      for (; i+15 < pixelCount; i += 16) {
+         __m128i rv = _mm_loadu_si128((const __m128i *) (r + i));
+         __m128i gv = _mm_loadu_si128((const __m128i *) (g + i));
+         __m128i bv = _mm_loadu_si128((const __m128i *) (b + i));
+         __m128i av = _mm_loadu_si128((const __m128i *) (a + i));
+         __m128i rg0 = _mm_unpacklo_epi8(rv, gv), rg1 = _mm_unpackhi_epi8(rv, gv);
+         __m128i ba0 = _mm_unpacklo_epi8(bv, av), ba1 = _mm_unpackhi_epi8(bv, av);
+         _mm_storeu_si128((__m128i *) (out + 4*i +  0), _mm_unpacklo_epi16(rg0, ba0));
+         _mm_storeu_si128((__m128i *) (out + 4*i + 16), _mm_unpackhi_epi16(rg0, ba0));
+         _mm_storeu_si128((__m128i *) (out + 4*i + 32), _mm_unpacklo_epi16(rg1, ba1));
+         _mm_storeu_si128((__m128i *) (out + 4*i + 48), _mm_unpackhi_epi16(rg1, ba1));
+      }
+   }
+#endif
+
+#ifdef STBI_NEON
+   for (; i+15 < pixelCount; i += 16) {
+      uint8x16x4_t o;
+      o.val[0] = vld1q_u8(r + i);
+      o.val[1] = vld1q_u8(g + i);
+      o.val[2] = vld1q_u8(b + i);
+      o.val[3] = vld1q_u8(a + i);
+      vst4q_u8(out + 4*i, o);
+   }
+#endif
+
+   for (; i < pixelCount; ++i) {
+      out[4*i+0] = r[i];
+      out[4*i+1] = g[i];
+      out[4*i+2] = b[i];
+      out[4*i+3] = a[i];
+   }
+}
+
 static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    int pixelCount;
@@ -5949,7 +6728,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
    int channel, i;
    int bitdepth;
    int w,h;
-   stbi_uc *out;
+   stbi_uc *out, *planes;
    STBI_NOTUSED(ri);
 
    // Check identifier
@@ -5974,6 +6753,7 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
 
    if (h > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
    if (w > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
+   if (!stbi__within_limits(w, h)) return NULL;
 
    // Make sure the depth is 8 bits.
    bitdepth = stbi__get16be(s);
@@ -6042,23 +6822,41 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
       // which we're going to just skip.
       stbi__skip(s, h * channelCount * 2 );
 
+      planes = (stbi_uc *) stbi__malloc_mad2(pixelCount, 4, 0);
+      if (!planes) { stbi__free(out); return stbi__errpuc("outofmem", "Out of memory"); }
+
       // Read the RLE data by channel.
       for (channel = 0; channel < 4; channel++) {
-         stbi_uc *p;
-
-         p = out+channel;
+         stbi_uc *p = planes + channel*pixelCount;
          if (channel >= channelCount) {
             // Fill this channel with default data.
-            for (i = 0; i < pixelCount; i++, p += 4)
-               *p = (channel == 3 ? 255 : 0);
+            memset(p, channel == 3 ? 255 : 0, pixelCount);
          } else {
             // Read the RLE data.
             if (!stbi__psd_decode_rle(s, p, pixelCount)) {
-               STBI_FREE(out);
+               stbi__free(planes);
+               stbi__free(out);
                return stbi__errpuc("corrupt", "bad RLE data");
             }
          }
       }
+      stbi__psd_interleave(out, planes, pixelCount);
+      stbi__free(planes);
+
+   } else if (bitdepth == 8) {
+      // 8-bit raw planes can be read straight in and interleaved afterwards
+      planes = (stbi_uc *) stbi__malloc_mad2(pixelCount, 4, 0);
+      if (!planes) { stbi__free(out); return stbi__errpuc("outofmem", "Out of memory"); }
+      for (channel = 0; channel < 4; channel++) {
+         stbi_uc *p = planes + channel*pixelCount;
+         if (channel >= channelCount)
+            memset(p, channel == 3 ? 255 : 0, pixelCount);
+         else if (!stbi__getn(s, p, pixelCount))
+            for (i = 0; i < pixelCount; i++)
+               p[i] = stbi__get8(s);
+      }
+      stbi__psd_interleave(out, planes, pixelCount);
+      stbi__free(planes);
 
    } else {
       // We're at the raw image data.  It's each channel in order (Red, Green, Blue, Alpha, ...)
@@ -6206,6 +7004,36 @@ static void stbi__copyval(int channel,stbi_uc *dest,const stbi_uc *src)
          dest[i]=src[i];
 }
 
+// write a run of count RGBA pixels; the channel mask is tested once per run
+// rather than once per pixel, and full-pixel runs become wide copies
+static void stbi__pic_fill_run(int channel,stbi_uc *dest,const stbi_uc *value,int count)
+{
+   int i;
+
+   if (count <= 0) return;
+   switch (channel & 0xF0) {
+      case 0xF0: // RGBA
+         memcpy(dest, value, 4);
+         stbi__fill_run(dest, count, 4);
+         break;
+      case 0xE0: // RGB, alpha comes from another packet
+         for (i=0; i < count; ++i, dest += 4) {
+            dest[0] = value[0];
+            dest[1] = value[1];
+            dest[2] = value[2];
+         }
+         break;
+      case 0x10: // alpha only
+         for (i=0; i < count; ++i, dest += 4)
+            dest[3] = value[3];
+         break;
+      default:
+         for (i=0; i < count; ++i, dest += 4)
+            stbi__copyval(channel,dest,value);
+         break;
+   }
+}
+
 static stbi_uc *stbi__pic_load_core(stbi__context *s,int width,int height,int *comp, stbi_uc *result)
 {
    int act_comp=0,num_packets=0,y,chained;
@@ -6256,7 +7084,7 @@ static stbi_uc *stbi__pic_load_core(stbi__context *s,int width,int height,int *c
 
             case 1://Pure RLE
                {
-                  int left=width, i;
+                  int left=width;
 
                   while (left>0) {
                      stbi_uc count,value[4];
@@ -6269,8 +7097,8 @@ static stbi_uc *stbi__pic_load_core(stbi__context *s,int width,int height,int *c
 
                      if (!stbi__readval(s,packet->channel,value))  return 0;
 
-                     for(i=0; i<count; ++i,dest+=4)
-                        stbi__copyval(packet->channel,dest,value);
+                     stbi__pic_fill_run(packet->channel,dest,value,count);
+                     dest += count*4;
                      left -= count;
                   }
                }
@@ -6295,8 +7123,8 @@ static stbi_uc *stbi__pic_load_core(stbi__context *s,int width,int height,int *c
                      if (!stbi__readval(s,packet->channel,value))
                         return 0;
 
-                     for(i=0;i<count;++i, dest += 4)
-                        stbi__copyval(packet->channel,dest,value);
+                     stbi__pic_fill_run(packet->channel,dest,value,count);
+                     dest += count*4;
                   } else { // Raw
                      ++count;
                      if (count>left) return stbi__errpuc("bad file","scanline overrun");
@@ -6332,6 +7160,7 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
 
    if (y > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
    if (x > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
+   if (!stbi__within_limits(x, y)) return NULL;
 
    if (stbi__at_eof(s))  return stbi__errpuc("bad file","file too short (pic header)");
    if (!stbi__mad3sizes_valid(x, y, 4, 0)) return stbi__errpuc("too large", "PIC image too large to decode");
@@ -6342,10 +7171,11 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
 
    // intermediate buffer is RGBA
    result = (stbi_uc *) stbi__malloc_mad3(x, y, 4, 0);
+   if (!result) return stbi__errpuc("outofmem", "Out of memory");
    memset(result, 0xff, x*y*4);
 
    if (!stbi__pic_load_core(s,x,y,comp, result)) {
-      STBI_FREE(result);
+      stbi__free(result);
       result=0;
    }
    *px = x;
@@ -6448,6 +7278,8 @@ static int stbi__gif_header(stbi__context *s, stbi__gif *g, int *comp, int is_in
 
    if (is_info) return 1;
 
+   if (!stbi__within_limits(g->w, g->h)) return 0;
+
    if (g->flags & 0x80)
       stbi__gif_parse_colortable(s,g->pal, 2 << (g->flags & 7), -1);
 
@@ -6457,14 +7289,15 @@ static int stbi__gif_header(stbi__context *s, stbi__gif *g, int *comp, int is_in
 static int stbi__gif_info_raw(stbi__context *s, int *x, int *y, int *comp)
 {
    stbi__gif* g = (stbi__gif*) stbi__malloc(sizeof(stbi__gif));
+   if (!g) return stbi__err("outofmem", "Out of memory");
    if (!stbi__gif_header(s, g, comp, 1)) {
-      STBI_FREE(g);
+      stbi__free(g);
       stbi__rewind( s );
       return 0;
    }
    if (x) *x = g->w;
    if (y) *y = g->h;
-   STBI_FREE(g);
+   stbi__free(g);
    return 1;
 }
 
@@ -6766,6 +7599,20 @@ static stbi_uc *stbi__gif_load_next(stbi__context *s, stbi__gif *g, int *comp, i
    }
 }
 
+static void *stbi__load_gif_main_outofmem(stbi__gif *g, stbi_uc *out, int **delays)
+{
+   stbi__free(g->out);
+   stbi__free(g->history);
+   stbi__free(g->background);
+
+   if (out) stbi__free(out);
+   if (delays && *delays) {
+      stbi__free(*delays);
+      *delays = NULL;
+   }
+   return stbi__limit_result(stbi__errpuc("outofmem", "Out of memory"));
+}
+
 static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
    if (stbi__gif_test(s)) {
@@ -6793,27 +7640,30 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
             stride = g.w * g.h * 4;
 
             if (out) {
-               void *tmp = (stbi_uc*) STBI_REALLOC_SIZED( out, out_size, layers * stride );
-               if (NULL == tmp) {
-                  STBI_FREE(g.out);
-                  STBI_FREE(g.history);
-                  STBI_FREE(g.background);
-                  return stbi__errpuc("outofmem", "Out of memory");
-               }
+               void *tmp = (stbi_uc*) stbi__realloc_sized( out, out_size, layers * stride );
+               if (NULL == tmp)
+                  return stbi__load_gif_main_outofmem(&g, out, delays);
                else {
                    out = (stbi_uc*) tmp;
                    out_size = layers * stride;
                }
 
                if (delays) {
-                  *delays = (int*) STBI_REALLOC_SIZED( *delays, delays_size, sizeof(int) * layers );
+                  int *new_delays = (int*) stbi__realloc_sized( *delays, delays_size, sizeof(int) * layers );
+                  if (!new_delays)
+                     return stbi__load_gif_main_outofmem(&g, out, delays);
+                  *delays = new_delays;
                   delays_size = layers * sizeof(int);
                }
             } else {
                out = (stbi_uc*)stbi__malloc( layers * stride );
+               if (!out)
+                  return stbi__load_gif_main_outofmem(&g, out, delays);
                out_size = layers * stride;
                if (delays) {
                   *delays = (int*) stbi__malloc( layers * sizeof(int) );
+                  if (!*delays)
+                     return stbi__load_gif_main_outofmem(&g, out, delays);
                   delays_size = layers * sizeof(int);
                }
             }
@@ -6829,16 +7679,16 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
       } while (u != 0);
 
       // free temp buffer;
-      STBI_FREE(g.out);
-      STBI_FREE(g.history);
-      STBI_FREE(g.background);
+      stbi__free(g.out);
+      stbi__free(g.history);
+      stbi__free(g.background);
 
       // do the final conversion after loading everything;
       if (req_comp && req_comp != 4)
          out = stbi__convert_format(out, 4, req_comp, layers * g.w, g.h);
 
       *z = layers;
-      return out;
+      return stbi__limit_result(out);
    } else {
       return stbi__errpuc("not GIF", "Image was not as a gif type.");
    }
@@ -6863,12 +7713,12 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
          u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
-      STBI_FREE(g.out);
+      stbi__free(g.out);
    }
 
    // free buffers needed for multiple frame loading;
-   STBI_FREE(g.history);
-   STBI_FREE(g.background);
+   stbi__free(g.history);
+   stbi__free(g.background);
 
    return u;
 }
@@ -6995,6 +7845,7 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 
    if (height > STBI_MAX_DIMENSIONS) return stbi__errpf("too large","Very large image (corrupt?)");
    if (width > STBI_MAX_DIMENSIONS) return stbi__errpf("too large","Very large image (corrupt?)");
+   if (!stbi__within_limits(width, height)) return NULL;
 
    *x = width;
    *y = height;
@@ -7041,16 +7892,16 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
             stbi__hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            STBI_FREE(scanline);
+            stbi__free(scanline);
             goto main_decode_loop; // yes, this makes no sense
          }
          len <<= 8;
          len |= stbi__get8(s);
-         if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
          if (scanline == NULL) {
             scanline = (stbi_uc *) stbi__malloc_mad2(width, 4, 0);
             if (!scanline) {
-               STBI_FREE(hdr_data);
+               stbi__free(hdr_data);
                return stbi__errpf("outofmem", "Out of memory");
             }
          }
@@ -7064,12 +7915,12 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
                   // Run
                   value = stbi__get8(s);
                   count -= 128;
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if (count > nleft) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                   for (z = 0; z < count; ++z)
                      scanline[i++ * 4 + k] = value;
                } else {
                   // Dump
-                  if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
+                  if (count > nleft) { stbi__free(hdr_data); stbi__free(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
                   for (z = 0; z < count; ++z)
                      scanline[i++ * 4 + k] = stbi__get8(s);
                }
@@ -7079,7 +7930,7 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
             stbi__hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
       }
       if (scanline)
-         STBI_FREE(scanline);
+         stbi__free(scanline);
    }
 
    return hdr_data;
@@ -7290,6 +8141,14 @@ static int stbi__pic_info(stbi__context *s, int *x, int *y, int *comp)
 
 #ifndef STBI_NO_PNM
 
+#if !defined(STBI_NO_STDIO) && (defined(__unix__) || defined(__APPLE__))
+#define STBI__PNM_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 static int      stbi__pnm_test(stbi__context *s)
 {
    char p, t;
@@ -7312,6 +8171,7 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
 
    if (s->img_y > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
    if (s->img_x > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
+   if (!stbi__within_limits(s->img_x, s->img_y)) return NULL;
 
    *x = s->img_x;
    *y = s->img_y;
@@ -7404,6 +8264,83 @@ static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp)
    else
       return 1;
 }
+
+#ifndef STBI_NO_STDIO
+typedef struct
+{
+   void    *base;    // file mapping, or NULL if the image was loaded instead
+   size_t   size;
+   stbi_uc *loaded;
+} stbi__pnm_mapping;
+
+STBIDEF stbi_uc const *stbi_pnm_map(char const *filename, int *x, int *y, int *comp, int req_comp, void **mapping)
+{
+   stbi__pnm_mapping *m;
+   stbi__begin_load();
+   m = (stbi__pnm_mapping *) stbi__malloc(sizeof(*m));
+   *mapping = NULL;
+   if (!m) return stbi__errpuc("outofmem", "Out of memory");
+   m->base = NULL;
+   m->size = 0;
+   m->loaded = NULL;
+
+#ifdef STBI__PNM_MMAP
+   if (!stbi__vertically_flip_on_load) {
+      int fd = open(filename, O_RDONLY);
+      if (fd >= 0) {
+         struct stat st;
+         if (fstat(fd, &st) == 0 && st.st_size > 0 && (unsigned long long) st.st_size <= INT_MAX) {
+            void *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base != MAP_FAILED) {
+               m->base = base;
+               m->size = (size_t) st.st_size;
+            }
+         }
+         close(fd);
+      }
+   }
+   if (m->base) {
+      stbi__context s;
+      int w, h, n;
+      stbi__start_mem(&s, (stbi_uc const *) m->base, (int) m->size);
+      if (stbi__pnm_info(&s, &w, &h, &n) && w > 0 && h > 0
+            && w <= STBI_MAX_DIMENSIONS && h <= STBI_MAX_DIMENSIONS && stbi__within_limits(w, h)
+            && (req_comp == 0 || req_comp == n) && stbi__mad3sizes_valid(n, w, h, 0)) {
+         size_t offset = (size_t) (s.img_buffer - s.img_buffer_original);
+         if (offset + (size_t) w * h * n <= m->size) {
+            *x = w;
+            *y = h;
+            if (comp) *comp = n;
+            *mapping = m;
+            return (stbi_uc const *) m->base + offset;
+         }
+      }
+      munmap(m->base, m->size);
+      m->base = NULL;
+   }
+#endif
+
+   // can't use the file in place, so decode (and convert/flip) it normally
+   m->loaded = stbi_load(filename, x, y, comp, req_comp);
+   if (!m->loaded) {
+      stbi__free(m);
+      return NULL;
+   }
+   *mapping = m;
+   return m->loaded;
+}
+
+STBIDEF void stbi_pnm_unmap(void *mapping)
+{
+   stbi__pnm_mapping *m = (stbi__pnm_mapping *) mapping;
+   if (!m) return;
+#ifdef STBI__PNM_MMAP
+   if (m->base) munmap(m->base, m->size);
+#endif
+   STBI_FREE(m->loaded);
+   STBI_FREE(m);
+}
+#endif // STBI_NO_STDIO
 #endif
 
 static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
@@ -7445,6 +8382,8 @@ static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
    if (stbi__tga_info(s, x, y, comp))
        return 1;
    #endif
+   if (stbi__limit_hit)
+      return stbi__err("limits exceeded", "Image exceeds load limits");
    return stbi__err("unknown image type", "Image not of any known type, or corrupt");
 }
 
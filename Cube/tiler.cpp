@@ -0,0 +1,30 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+
+#include "VirtualTextureFile.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// cuts an image into the paged file a VirtualTexture streams from:
+//   Tiler <image> <paged file> [tile size]
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <image> <paged file> [tile size]\n", argv[0]);
+        return 1;
+    }
+    int tileSize = argc > 3 ? atoi(argv[3]) : 128;
+    if (tileSize < 16)
+    {
+        printf("tile size must be at least 16\n");
+        return 1;
+    }
+    // flipped like the cube's textures, so texcoord 0 is the bottom of the image
+    stbi_set_flip_vertically_on_load(true);
+    if (!VirtualTextureFile::tile(argv[1], argv[2], tileSize))
+        return 1;
+    printf("Wrote %s.\n", argv[2]);
+    return 0;
+}
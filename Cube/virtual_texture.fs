@@ -0,0 +1,66 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+// built with VT_FEEDBACK for the feedback pass, which writes the tile each
+// pixel samples from for VirtualTexture to load, and without it to sample
+// the texture (see ShaderVariants.h)
+uniform vec2 vtSize;
+uniform int vtLevels;
+uniform float vtTileSize;
+
+// the level of detail of TexCoord, unclamped
+float detail()
+{
+	// derivatives of the unwrapped coordinates, so the wrap doesn't show as a seam
+	vec2 dx = dFdx(TexCoord * vtSize), dy = dFdy(TexCoord * vtSize);
+	return 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+}
+
+#ifdef VT_FEEDBACK
+
+// makes up for the feedback buffer being smaller than the screen
+uniform float vtLodBias;
+
+void main()
+{
+	float lod = clamp(detail() + vtLodBias, 0.0, float(vtLevels - 1));
+	int level = int(lod);
+	ivec2 page = ivec2(fract(TexCoord) * vtSize / (vtTileSize * float(1 << level)));
+	// 10 bits of x and y, 4 of level; alpha 255 marks a request
+	FragColor = vec4(page.x & 255, page.y & 255, (page.x >> 8) | ((page.y >> 8) << 2) | (level << 4), 255) / 255.0;
+}
+
+#else
+
+// the physical cache of resident tiles and the indirection table pointing into
+// it, one texel per tile of every level (see VirtualTexture.h)
+uniform sampler2D vtCache;
+uniform sampler2D vtIndirection;
+uniform float vtBorder;
+uniform float vtCacheSize;
+uniform int vtLevelRow[16];
+
+// bilinear sample of one level, from the finest resident tile that covers it
+vec4 sampleLevel(vec2 texel, int level)
+{
+	ivec2 page = ivec2(texel / (vtTileSize * float(1 << level)));
+	vec4 entry = texelFetch(vtIndirection, ivec2(page.x, vtLevelRow[level] + page.y), 0) * 255.0;
+	int resident = int(entry.b + 0.5);
+	vec2 coord = texel / float(1 << resident);
+	vec2 inTile = coord - floor(coord / vtTileSize) * vtTileSize;
+	vec2 physical = floor(entry.rg + 0.5) * (vtTileSize + 2.0 * vtBorder) + vtBorder + inTile;
+	return textureLod(vtCache, physical / vtCacheSize, 0.0);
+}
+
+void main()
+{
+	float lod = clamp(detail(), 0.0, float(vtLevels - 1));
+	vec2 texel = fract(TexCoord) * vtSize;
+	int level = int(lod);
+	// trilinear, with the blend between levels done here
+	FragColor = mix(sampleLevel(texel, level), sampleLevel(texel, min(level + 1, vtLevels - 1)), fract(lod));
+}
+
+#endif